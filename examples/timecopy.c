@@ -0,0 +1,132 @@
+/*
+ * Measure performance of the plane copy / conversion kernels.
+ *
+ * Copyright (c) 2014 struktur AG, Joachim Bauch <bauch@struktur.de>
+ *
+ * This file is part of gstreamer-libde265.
+ *
+ * libde265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libde265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libde265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "libde265-copy.h"
+
+// Frames copied per measurement, scaled down for larger resolutions.
+#define PIXELS_PER_RUN (1920 * 1080 * 200)
+
+struct resolution
+{
+  const char *name;
+  int width;
+  int height;
+};
+
+static const struct resolution resolutions[] = {
+  {"576p", 720, 576},
+  {"720p", 1280, 720},
+  {"1080p", 1920, 1088},
+  {"2160p", 3840, 2160},
+  {"4320p", 7680, 4320},
+};
+
+struct conversion
+{
+  const char *name;
+  int src_bits;
+  int dst_bits;
+  // extra bytes per source row to force the stride-mismatched path
+  int src_padding;
+};
+
+static const struct conversion conversions[] = {
+  {"16->16 shift", 12, 10, 0},
+  {"16->8 narrow", 10, 8, 0},
+  {"8->16 widen", 8, 10, 0},
+  {"stride copy", 8, 8, 64},
+};
+
+static double
+time_conversion (const struct conversion *conv, const struct resolution *res,
+    guint8 * src, guint8 * dst)
+{
+  int src_stride = res->width * ((conv->src_bits + 7) / 8) + conv->src_padding;
+  int dst_stride = res->width * ((conv->dst_bits + 7) / 8);
+  int frames = MAX (PIXELS_PER_RUN / (res->width * res->height), 5);
+  gint64 start;
+  int i;
+
+  // warm up caches and page tables
+  gst_libde265_copy_plane (dst, dst_stride, src, src_stride, res->width,
+      res->height, conv->src_bits, conv->dst_bits);
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < frames; i++) {
+    gst_libde265_copy_plane (dst, dst_stride, src, src_stride, res->width,
+        res->height, conv->src_bits, conv->dst_bits);
+  }
+  return (g_get_monotonic_time () - start) / 1000.0 / frames;
+}
+
+int
+main (int argc, char *argv[])
+{
+  const struct resolution *largest = &resolutions[G_N_ELEMENTS (resolutions) -
+      1];
+  gsize size = (gsize) (largest->width * 2 + 64) * largest->height;
+  guint8 *src = g_malloc (size);
+  guint8 *dst = g_malloc (size);
+  GstLibde265CopyImpl best;
+  guint c, r;
+  gsize i;
+
+  for (i = 0; i < size; i++) {
+    // keep samples within 10 bits so every conversion is meaningful
+    src[i] = (i * 7) & ((i & 1) ? 0x03 : 0xff);
+  }
+
+  best = gst_libde265_copy_select (GST_LIBDE265_COPY_IMPL_AUTO);
+  g_print ("Best available kernels: %s\n\n",
+      gst_libde265_copy_impl_name (best));
+  g_print ("%-14s %-6s", "conversion", "size");
+  for (i = GST_LIBDE265_COPY_IMPL_SCALAR; i <= (gsize) best; i++) {
+    g_print (" %10s", gst_libde265_copy_impl_name ((GstLibde265CopyImpl) i));
+  }
+  g_print (" %8s\n", "speedup");
+
+  for (c = 0; c < G_N_ELEMENTS (conversions); c++) {
+    for (r = 0; r < G_N_ELEMENTS (resolutions); r++) {
+      double scalar_ms = 0;
+      double ms = 0;
+
+      g_print ("%-14s %-6s", conversions[c].name, resolutions[r].name);
+      for (i = GST_LIBDE265_COPY_IMPL_SCALAR; i <= (gsize) best; i++) {
+        gst_libde265_copy_select ((GstLibde265CopyImpl) i);
+        ms = time_conversion (&conversions[c], &resolutions[r], src, dst);
+        if (i == GST_LIBDE265_COPY_IMPL_SCALAR) {
+          scalar_ms = ms;
+        }
+        g_print (" %7.3f ms", ms);
+      }
+      g_print (" %7.2fx\n", ms > 0 ? scalar_ms / ms : 0);
+    }
+  }
+
+  g_free (src);
+  g_free (dst);
+  return 0;
+}
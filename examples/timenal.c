@@ -0,0 +1,119 @@
+/*
+ * Compare feeding NAL units to the decoder one by one (de265_push_NAL)
+ * against batching them into one Annex-B block (de265_push_data).
+ *
+ * Copyright (c) 2014 struktur AG, Joachim Bauch <bauch@struktur.de>
+ *
+ * This file is part of gstreamer-libde265.
+ *
+ * libde265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libde265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libde265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+#include <libde265/de265.h>
+
+// NAL units pushed per measurement
+#define NALS_PER_RUN (200 * 1000)
+
+static const int nals_per_frame[] = { 1, 4, 17, 68, 270 };
+static const int nal_sizes[] = { 200, 1000, 4000, 16000 };
+
+/*
+ * Pass the NAL units of "frames" frames to the decoder one by one, as the
+ * plugin does for packetized input. The queued NAL units are dropped after
+ * every frame, they are never decoded.
+ */
+static double
+time_single (de265_decoder_context * ctx, const guint8 * nal, int nal_size,
+    int count, int frames)
+{
+  gint64 start = g_get_monotonic_time ();
+  int f, i;
+
+  for (f = 0; f < frames; f++) {
+    for (i = 0; i < count; i++) {
+      de265_push_NAL (ctx, nal, nal_size, f, NULL);
+    }
+    de265_reset (ctx);
+  }
+  return (g_get_monotonic_time () - start) / 1000.0 / frames;
+}
+
+// Same as above, but the NAL units are rewritten to one Annex-B block.
+static double
+time_batched (de265_decoder_context * ctx, const guint8 * nal, int nal_size,
+    int count, int frames, guint8 * arena)
+{
+  gint64 start = g_get_monotonic_time ();
+  int f, i;
+
+  for (f = 0; f < frames; f++) {
+    guint8 *out = arena;
+    for (i = 0; i < count; i++) {
+      out[0] = 0;
+      out[1] = 0;
+      out[2] = 1;
+      memcpy (out + 3, nal, nal_size);
+      out += 3 + nal_size;
+    }
+    de265_push_data (ctx, arena, out - arena, f, NULL);
+    de265_push_end_of_NAL (ctx);
+    de265_reset (ctx);
+  }
+  return (g_get_monotonic_time () - start) / 1000.0 / frames;
+}
+
+int
+main (int argc, char *argv[])
+{
+  int max_size = nal_sizes[G_N_ELEMENTS (nal_sizes) - 1];
+  int max_count = nals_per_frame[G_N_ELEMENTS (nals_per_frame) - 1];
+  guint8 *nal = g_malloc (max_size);
+  guint8 *arena = g_malloc ((gsize) (max_size + 3) * max_count);
+  de265_decoder_context *ctx = de265_new_decoder ();
+  guint c, s;
+  int i;
+
+  // slice NAL unit header, the payload never contains a start code
+  nal[0] = 1 << 1;
+  nal[1] = 1;
+  for (i = 2; i < max_size; i++) {
+    nal[i] = 1 + (i * 7) % 255;
+  }
+
+  g_print ("%-8s %-8s %12s %12s %8s\n", "NALs", "size", "single",
+      "batched", "speedup");
+  for (c = 0; c < G_N_ELEMENTS (nals_per_frame); c++) {
+    for (s = 0; s < G_N_ELEMENTS (nal_sizes); s++) {
+      int count = nals_per_frame[c];
+      int frames = MAX (NALS_PER_RUN / count / (nal_sizes[s] / 200), 5);
+      double single_ms, batched_ms;
+
+      // warm up the NAL unit free list of the decoder
+      time_single (ctx, nal, nal_sizes[s], count, 1);
+      single_ms = time_single (ctx, nal, nal_sizes[s], count, frames);
+      batched_ms = time_batched (ctx, nal, nal_sizes[s], count, frames, arena);
+      g_print ("%-8d %-8d %9.4f ms %9.4f ms %7.2fx\n", count, nal_sizes[s],
+          single_ms, batched_ms, batched_ms > 0 ? single_ms / batched_ms : 0);
+    }
+  }
+
+  de265_free_decoder (ctx);
+  g_free (arena);
+  g_free (nal);
+  return 0;
+}
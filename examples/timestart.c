@@ -0,0 +1,176 @@
+/*
+ * Measure the time to the first decoded frame of restarted pipelines with
+ * and without the libde265 decoder context pool.
+ *
+ * Copyright (c) 2014 struktur AG, Joachim Bauch <bauch@struktur.de>
+ *
+ * This file is part of gstreamer-libde265.
+ *
+ * libde265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libde265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libde265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+
+#include <gst/gst.h>
+#include <glib.h>
+
+static gint first_frame;
+
+static void
+on_pad_added (GstElement * element, GstPad * pad, gpointer data)
+{
+  GstElement *decoder = (GstElement *) data;
+  GstPad *sinkpad = gst_element_get_static_pad (decoder, "sink");
+
+  gst_pad_link (pad, sinkpad);
+  gst_object_unref (sinkpad);
+}
+
+static void
+on_handoff (GstElement * sink, GstBuffer * buffer, GstPad * pad,
+    gpointer data)
+{
+  if (g_atomic_int_compare_and_exchange (&first_frame, 0, 1)) {
+    gst_element_post_message (sink,
+        gst_message_new_application (GST_OBJECT (sink),
+            gst_structure_new ("FirstFrame", NULL, NULL)));
+  }
+}
+
+/*
+ * Start a pipeline decoding the file, wait for its first frame and stop
+ * it again. Returns the time to the first frame in microseconds or -1.
+ */
+static gint64
+time_first_frame (const gchar * filename, int pool)
+{
+  GstElement *pipeline = gst_pipeline_new ("time-start");
+  GstElement *source = gst_element_factory_make ("filesrc", NULL);
+  GstElement *demuxer =
+      gst_element_factory_make ("matroskademux-libde265", NULL);
+  GstElement *decoder = gst_element_factory_make ("libde265dec", NULL);
+  GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+  gint64 start;
+  gint64 result = -1;
+
+  if (source == NULL || demuxer == NULL || decoder == NULL || sink == NULL) {
+    g_printerr ("Could not create elements, please check your GStreamer "
+        "plugin path.\n");
+    return -1;
+  }
+  g_object_set (G_OBJECT (source), "location", filename, NULL);
+  g_object_set (G_OBJECT (decoder), "context-pool", pool, NULL);
+  g_object_set (G_OBJECT (sink), "sync", FALSE, "signal-handoffs", TRUE,
+      NULL);
+  gst_bin_add_many (GST_BIN (pipeline), source, demuxer, decoder, sink, NULL);
+  gst_element_link (source, demuxer);
+  gst_element_link (decoder, sink);
+  g_signal_connect (demuxer, "pad-added", G_CALLBACK (on_pad_added), decoder);
+  g_signal_connect (sink, "handoff", G_CALLBACK (on_handoff), NULL);
+
+  GstBus *bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  g_atomic_int_set (&first_frame, 0);
+  start = g_get_monotonic_time ();
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  while (result < 0) {
+    GstMessage *msg = gst_bus_timed_pop_filtered (bus, 10 * GST_SECOND,
+        GST_MESSAGE_APPLICATION | GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+    if (msg == NULL) {
+      g_printerr ("Timeout waiting for the first frame\n");
+      break;
+    }
+    if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_APPLICATION) {
+      result = g_get_monotonic_time () - start;
+    } else {
+      g_printerr ("%s before the first frame\n",
+          GST_MESSAGE_TYPE_NAME (msg));
+      gst_message_unref (msg);
+      break;
+    }
+    gst_message_unref (msg);
+  }
+  gst_object_unref (bus);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (GST_OBJECT (pipeline));
+  return result;
+}
+
+static gboolean
+run (const gchar * filename, int pool, int runs)
+{
+  gint64 total = 0;
+  gint64 min = G_MAXINT64;
+  gint64 max = 0;
+  int i;
+
+  // the first run fills the file cache (and the context pool)
+  if (time_first_frame (filename, pool) < 0) {
+    return FALSE;
+  }
+  for (i = 0; i < runs; i++) {
+    gint64 t = time_first_frame (filename, pool);
+    if (t < 0) {
+      return FALSE;
+    }
+    total += t;
+    min = MIN (min, t);
+    max = MAX (max, t);
+  }
+  printf ("context-pool=%d: time to first frame min=%.3f avg=%.3f "
+      "max=%.3f ms (%d runs)\n", pool, min / 1000.0,
+      total / 1000.0 / runs, max / 1000.0, runs);
+  return TRUE;
+}
+
+int
+main (int argc, char *argv[])
+{
+  int runs = 20;
+  int pool = 1;
+  GOptionEntry options[] = {
+    {"runs", 'r', 0, G_OPTION_ARG_INT, &runs,
+        "Number of measured pipeline restarts", "N"},
+    {"pool", 'p', 0, G_OPTION_ARG_INT, &pool,
+        "Size of the context pool for the pooled runs", "N"},
+    {NULL}
+  };
+  GOptionContext *ctx;
+  GError *err = NULL;
+
+  ctx = g_option_context_new ("<filename>");
+  g_option_context_add_main_entries (ctx, options, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    if (err) {
+      g_printerr ("Error initializing: %s\n", GST_STR_NULL (err->message));
+    } else {
+      g_printerr ("Error initializing: Unknown error!\n");
+    }
+    return -1;
+  }
+  g_option_context_free (ctx);
+
+  if (argc != 2 || runs < 1 || pool < 1) {
+    g_printerr ("Usage: %s [--runs N] [--pool N] filename\n", argv[0]);
+    return -1;
+  }
+
+  if (!run (argv[1], 0, runs) || !run (argv[1], pool, runs)) {
+    return -1;
+  }
+
+  gst_deinit ();
+  return 0;
+}
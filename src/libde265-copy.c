@@ -0,0 +1,913 @@
+/*
+ * GStreamer HEVC/H.265 video codec.
+ *
+ * Copyright (c) 2014 struktur AG, Joachim Bauch <bauch@struktur.de>
+ *
+ * This file is part of gstreamer-libde265.
+ *
+ * libde265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libde265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libde265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "libde265-copy.h"
+#include "libde265-threads.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__ ((target ("sse2")))
+#define TARGET_AVX2 __attribute__ ((target ("avx2")))
+#endif
+
+// images with less data than this per band are copied in the calling
+// thread, the copy is limited by memory bandwidth and a few workers are
+// enough to saturate it
+#define PARALLEL_BAND_BYTES     (2 * 1024 * 1024)
+#define MAX_COPY_WORKERS        4
+
+typedef void (*ShiftRowFunc) (guint16 * dst, const guint16 * src, int n,
+    int shift);
+typedef void (*NarrowRowFunc) (guint8 * dst, const guint16 * src, int n,
+    int shift);
+typedef void (*WidenRowFunc) (guint16 * dst, const guint8 * src, int n,
+    int shift);
+typedef void (*Interleave8RowFunc) (guint8 * dst, const guint8 * u,
+    const guint8 * v, int n);
+typedef void (*Interleave16RowFunc) (guint16 * dst, const guint16 * u,
+    const guint16 * v, int n, int shift);
+typedef void (*Box8RowFunc) (guint8 * dst, const guint8 * row0,
+    const guint8 * row1, int n);
+typedef void (*Box16RowFunc) (guint16 * dst, const guint16 * row0,
+    const guint16 * row1, int n);
+
+typedef struct
+{
+  ShiftRowFunc shr16;
+  ShiftRowFunc shl16;
+  NarrowRowFunc narrow;
+  WidenRowFunc widen;
+  Interleave8RowFunc interleave8;
+  Interleave16RowFunc interleave16;
+  // average 2x2 blocks of the two rows into n samples
+  Box8RowFunc box8;
+  Box16RowFunc box16;
+} CopyKernels;
+
+/* scalar fallback, also used for the row tails of the SIMD kernels */
+
+static void
+shr16_scalar (guint16 * dst, const guint16 * src, int n, int shift)
+{
+  int i;
+  for (i = 0; i < n; i++) {
+    dst[i] = src[i] >> shift;
+  }
+}
+
+static void
+shl16_scalar (guint16 * dst, const guint16 * src, int n, int shift)
+{
+  int i;
+  for (i = 0; i < n; i++) {
+    dst[i] = src[i] << shift;
+  }
+}
+
+static void
+narrow_scalar (guint8 * dst, const guint16 * src, int n, int shift)
+{
+  int i;
+  for (i = 0; i < n; i++) {
+    dst[i] = src[i] >> shift;
+  }
+}
+
+static void
+widen_scalar (guint16 * dst, const guint8 * src, int n, int shift)
+{
+  int i;
+  for (i = 0; i < n; i++) {
+    dst[i] = src[i] << shift;
+  }
+}
+
+static void
+interleave8_scalar (guint8 * dst, const guint8 * u, const guint8 * v, int n)
+{
+  int i;
+  for (i = 0; i < n; i++) {
+    dst[2 * i] = u[i];
+    dst[2 * i + 1] = v[i];
+  }
+}
+
+static void
+interleave16_scalar (guint16 * dst, const guint16 * u, const guint16 * v,
+    int n, int shift)
+{
+  int i;
+  for (i = 0; i < n; i++) {
+    dst[2 * i] = u[i] << shift;
+    dst[2 * i + 1] = v[i] << shift;
+  }
+}
+
+static void
+box8_scalar (guint8 * dst, const guint8 * row0, const guint8 * row1, int n)
+{
+  int i;
+  for (i = 0; i < n; i++) {
+    dst[i] = (row0[2 * i] + row0[2 * i + 1] + row1[2 * i] + row1[2 * i + 1]
+        + 2) >> 2;
+  }
+}
+
+static void
+box16_scalar (guint16 * dst, const guint16 * row0, const guint16 * row1,
+    int n)
+{
+  int i;
+  for (i = 0; i < n; i++) {
+    dst[i] = ((guint32) row0[2 * i] + row0[2 * i + 1] + row1[2 * i]
+        + row1[2 * i + 1] + 2) >> 2;
+  }
+}
+
+static const CopyKernels kernels_scalar = {
+  shr16_scalar, shl16_scalar, narrow_scalar, widen_scalar,
+  interleave8_scalar, interleave16_scalar, box8_scalar, box16_scalar
+};
+
+#ifdef HAVE_X86_KERNELS
+TARGET_SSE2 static void
+shr16_sse2 (guint16 * dst, const guint16 * src, int n, int shift)
+{
+  __m128i count = _mm_cvtsi32_si128 (shift);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i));
+    _mm_storeu_si128 ((__m128i *) (dst + i), _mm_srl_epi16 (v, count));
+  }
+  shr16_scalar (dst + i, src + i, n - i, shift);
+}
+
+TARGET_SSE2 static void
+shl16_sse2 (guint16 * dst, const guint16 * src, int n, int shift)
+{
+  __m128i count = _mm_cvtsi32_si128 (shift);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i));
+    _mm_storeu_si128 ((__m128i *) (dst + i), _mm_sll_epi16 (v, count));
+  }
+  shl16_scalar (dst + i, src + i, n - i, shift);
+}
+
+TARGET_SSE2 static void
+narrow_sse2 (guint8 * dst, const guint16 * src, int n, int shift)
+{
+  __m128i count = _mm_cvtsi32_si128 (shift);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i lo = _mm_loadu_si128 ((const __m128i *) (src + i));
+    __m128i hi = _mm_loadu_si128 ((const __m128i *) (src + i + 8));
+    lo = _mm_srl_epi16 (lo, count);
+    hi = _mm_srl_epi16 (hi, count);
+    _mm_storeu_si128 ((__m128i *) (dst + i), _mm_packus_epi16 (lo, hi));
+  }
+  narrow_scalar (dst + i, src + i, n - i, shift);
+}
+
+TARGET_SSE2 static void
+widen_sse2 (guint16 * dst, const guint8 * src, int n, int shift)
+{
+  __m128i count = _mm_cvtsi32_si128 (shift);
+  __m128i zero = _mm_setzero_si128 ();
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i));
+    __m128i lo = _mm_sll_epi16 (_mm_unpacklo_epi8 (v, zero), count);
+    __m128i hi = _mm_sll_epi16 (_mm_unpackhi_epi8 (v, zero), count);
+    _mm_storeu_si128 ((__m128i *) (dst + i), lo);
+    _mm_storeu_si128 ((__m128i *) (dst + i + 8), hi);
+  }
+  widen_scalar (dst + i, src + i, n - i, shift);
+}
+
+TARGET_SSE2 static void
+interleave8_sse2 (guint8 * dst, const guint8 * u, const guint8 * v, int n)
+{
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i a = _mm_loadu_si128 ((const __m128i *) (u + i));
+    __m128i b = _mm_loadu_si128 ((const __m128i *) (v + i));
+    _mm_storeu_si128 ((__m128i *) (dst + 2 * i), _mm_unpacklo_epi8 (a, b));
+    _mm_storeu_si128 ((__m128i *) (dst + 2 * i + 16),
+        _mm_unpackhi_epi8 (a, b));
+  }
+  interleave8_scalar (dst + 2 * i, u + i, v + i, n - i);
+}
+
+TARGET_SSE2 static void
+interleave16_sse2 (guint16 * dst, const guint16 * u, const guint16 * v,
+    int n, int shift)
+{
+  __m128i count = _mm_cvtsi32_si128 (shift);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i a = _mm_sll_epi16 (_mm_loadu_si128 ((const __m128i *) (u + i)),
+        count);
+    __m128i b = _mm_sll_epi16 (_mm_loadu_si128 ((const __m128i *) (v + i)),
+        count);
+    _mm_storeu_si128 ((__m128i *) (dst + 2 * i), _mm_unpacklo_epi16 (a, b));
+    _mm_storeu_si128 ((__m128i *) (dst + 2 * i + 8),
+        _mm_unpackhi_epi16 (a, b));
+  }
+  interleave16_scalar (dst + 2 * i, u + i, v + i, n - i, shift);
+}
+
+// sum of the horizontal byte pairs of two rows as 16 bit words
+TARGET_SSE2 static inline __m128i
+_box8_pairs_sse2 (const guint8 * row0, const guint8 * row1)
+{
+  __m128i mask = _mm_set1_epi16 (0x00ff);
+  __m128i a = _mm_loadu_si128 ((const __m128i *) row0);
+  __m128i b = _mm_loadu_si128 ((const __m128i *) row1);
+  __m128i sum = _mm_add_epi16 (_mm_and_si128 (a, mask), _mm_srli_epi16 (a,
+          8));
+  sum = _mm_add_epi16 (sum, _mm_and_si128 (b, mask));
+  return _mm_add_epi16 (sum, _mm_srli_epi16 (b, 8));
+}
+
+TARGET_SSE2 static void
+box8_sse2 (guint8 * dst, const guint8 * row0, const guint8 * row1, int n)
+{
+  __m128i round = _mm_set1_epi16 (2);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i lo = _box8_pairs_sse2 (row0 + 2 * i, row1 + 2 * i);
+    __m128i hi = _box8_pairs_sse2 (row0 + 2 * i + 16, row1 + 2 * i + 16);
+    lo = _mm_srli_epi16 (_mm_add_epi16 (lo, round), 2);
+    hi = _mm_srli_epi16 (_mm_add_epi16 (hi, round), 2);
+    _mm_storeu_si128 ((__m128i *) (dst + i), _mm_packus_epi16 (lo, hi));
+  }
+  box8_scalar (dst + i, row0 + 2 * i, row1 + 2 * i, n - i);
+}
+
+// averages of the 2x2 blocks as 32 bit words, 16 bit samples can't be
+// summed without overflow
+TARGET_SSE2 static inline __m128i
+_box16_pairs_sse2 (const guint16 * row0, const guint16 * row1)
+{
+  __m128i mask = _mm_set1_epi32 (0xffff);
+  __m128i a = _mm_loadu_si128 ((const __m128i *) row0);
+  __m128i b = _mm_loadu_si128 ((const __m128i *) row1);
+  __m128i sum = _mm_add_epi32 (_mm_and_si128 (a, mask), _mm_srli_epi32 (a,
+          16));
+  sum = _mm_add_epi32 (sum, _mm_and_si128 (b, mask));
+  sum = _mm_add_epi32 (sum, _mm_srli_epi32 (b, 16));
+  return _mm_srli_epi32 (_mm_add_epi32 (sum, _mm_set1_epi32 (2)), 2);
+}
+
+TARGET_SSE2 static void
+box16_sse2 (guint16 * dst, const guint16 * row0, const guint16 * row1,
+    int n)
+{
+  // SSE2 only packs with signed saturation, bias the values around zero
+  __m128i bias32 = _mm_set1_epi32 (0x8000);
+  __m128i bias16 = _mm_set1_epi16 ((short) 0x8000);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i lo = _box16_pairs_sse2 (row0 + 2 * i, row1 + 2 * i);
+    __m128i hi = _box16_pairs_sse2 (row0 + 2 * i + 8, row1 + 2 * i + 8);
+    __m128i packed = _mm_packs_epi32 (_mm_sub_epi32 (lo, bias32),
+        _mm_sub_epi32 (hi, bias32));
+    _mm_storeu_si128 ((__m128i *) (dst + i), _mm_xor_si128 (packed, bias16));
+  }
+  box16_scalar (dst + i, row0 + 2 * i, row1 + 2 * i, n - i);
+}
+
+static const CopyKernels kernels_sse2 = {
+  shr16_sse2, shl16_sse2, narrow_sse2, widen_sse2,
+  interleave8_sse2, interleave16_sse2, box8_sse2, box16_sse2
+};
+
+TARGET_AVX2 static void
+shr16_avx2 (guint16 * dst, const guint16 * src, int n, int shift)
+{
+  __m128i count = _mm_cvtsi32_si128 (shift);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i v = _mm256_loadu_si256 ((const __m256i *) (src + i));
+    _mm256_storeu_si256 ((__m256i *) (dst + i), _mm256_srl_epi16 (v, count));
+  }
+  shr16_scalar (dst + i, src + i, n - i, shift);
+}
+
+TARGET_AVX2 static void
+shl16_avx2 (guint16 * dst, const guint16 * src, int n, int shift)
+{
+  __m128i count = _mm_cvtsi32_si128 (shift);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i v = _mm256_loadu_si256 ((const __m256i *) (src + i));
+    _mm256_storeu_si256 ((__m256i *) (dst + i), _mm256_sll_epi16 (v, count));
+  }
+  shl16_scalar (dst + i, src + i, n - i, shift);
+}
+
+TARGET_AVX2 static void
+narrow_avx2 (guint8 * dst, const guint16 * src, int n, int shift)
+{
+  __m128i count = _mm_cvtsi32_si128 (shift);
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i lo = _mm256_loadu_si256 ((const __m256i *) (src + i));
+    __m256i hi = _mm256_loadu_si256 ((const __m256i *) (src + i + 16));
+    lo = _mm256_srl_epi16 (lo, count);
+    hi = _mm256_srl_epi16 (hi, count);
+    // packus works per 128 bit lane, restore the sample order afterwards
+    __m256i packed = _mm256_packus_epi16 (lo, hi);
+    packed = _mm256_permute4x64_epi64 (packed, 0xd8);
+    _mm256_storeu_si256 ((__m256i *) (dst + i), packed);
+  }
+  narrow_scalar (dst + i, src + i, n - i, shift);
+}
+
+TARGET_AVX2 static void
+widen_avx2 (guint16 * dst, const guint8 * src, int n, int shift)
+{
+  __m128i count = _mm_cvtsi32_si128 (shift);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i));
+    __m256i w = _mm256_sll_epi16 (_mm256_cvtepu8_epi16 (v), count);
+    _mm256_storeu_si256 ((__m256i *) (dst + i), w);
+  }
+  widen_scalar (dst + i, src + i, n - i, shift);
+}
+
+TARGET_AVX2 static void
+interleave8_avx2 (guint8 * dst, const guint8 * u, const guint8 * v, int n)
+{
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i a = _mm256_loadu_si256 ((const __m256i *) (u + i));
+    __m256i b = _mm256_loadu_si256 ((const __m256i *) (v + i));
+    // unpack works per 128 bit lane, swap the middle lanes when storing
+    __m256i lo = _mm256_unpacklo_epi8 (a, b);
+    __m256i hi = _mm256_unpackhi_epi8 (a, b);
+    _mm256_storeu_si256 ((__m256i *) (dst + 2 * i),
+        _mm256_permute2x128_si256 (lo, hi, 0x20));
+    _mm256_storeu_si256 ((__m256i *) (dst + 2 * i + 32),
+        _mm256_permute2x128_si256 (lo, hi, 0x31));
+  }
+  interleave8_scalar (dst + 2 * i, u + i, v + i, n - i);
+}
+
+TARGET_AVX2 static void
+interleave16_avx2 (guint16 * dst, const guint16 * u, const guint16 * v,
+    int n, int shift)
+{
+  __m128i count = _mm_cvtsi32_si128 (shift);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i a =
+        _mm256_sll_epi16 (_mm256_loadu_si256 ((const __m256i *) (u + i)),
+        count);
+    __m256i b =
+        _mm256_sll_epi16 (_mm256_loadu_si256 ((const __m256i *) (v + i)),
+        count);
+    __m256i lo = _mm256_unpacklo_epi16 (a, b);
+    __m256i hi = _mm256_unpackhi_epi16 (a, b);
+    _mm256_storeu_si256 ((__m256i *) (dst + 2 * i),
+        _mm256_permute2x128_si256 (lo, hi, 0x20));
+    _mm256_storeu_si256 ((__m256i *) (dst + 2 * i + 16),
+        _mm256_permute2x128_si256 (lo, hi, 0x31));
+  }
+  interleave16_scalar (dst + 2 * i, u + i, v + i, n - i, shift);
+}
+
+TARGET_AVX2 static inline __m256i
+_box8_pairs_avx2 (const guint8 * row0, const guint8 * row1)
+{
+  __m256i mask = _mm256_set1_epi16 (0x00ff);
+  __m256i a = _mm256_loadu_si256 ((const __m256i *) row0);
+  __m256i b = _mm256_loadu_si256 ((const __m256i *) row1);
+  __m256i sum = _mm256_add_epi16 (_mm256_and_si256 (a, mask),
+      _mm256_srli_epi16 (a, 8));
+  sum = _mm256_add_epi16 (sum, _mm256_and_si256 (b, mask));
+  return _mm256_add_epi16 (sum, _mm256_srli_epi16 (b, 8));
+}
+
+TARGET_AVX2 static void
+box8_avx2 (guint8 * dst, const guint8 * row0, const guint8 * row1, int n)
+{
+  __m256i round = _mm256_set1_epi16 (2);
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i lo = _box8_pairs_avx2 (row0 + 2 * i, row1 + 2 * i);
+    __m256i hi = _box8_pairs_avx2 (row0 + 2 * i + 32, row1 + 2 * i + 32);
+    lo = _mm256_srli_epi16 (_mm256_add_epi16 (lo, round), 2);
+    hi = _mm256_srli_epi16 (_mm256_add_epi16 (hi, round), 2);
+    // packus works per 128 bit lane, restore the sample order afterwards
+    __m256i packed = _mm256_packus_epi16 (lo, hi);
+    packed = _mm256_permute4x64_epi64 (packed, 0xd8);
+    _mm256_storeu_si256 ((__m256i *) (dst + i), packed);
+  }
+  box8_scalar (dst + i, row0 + 2 * i, row1 + 2 * i, n - i);
+}
+
+TARGET_AVX2 static inline __m256i
+_box16_pairs_avx2 (const guint16 * row0, const guint16 * row1)
+{
+  __m256i mask = _mm256_set1_epi32 (0xffff);
+  __m256i a = _mm256_loadu_si256 ((const __m256i *) row0);
+  __m256i b = _mm256_loadu_si256 ((const __m256i *) row1);
+  __m256i sum = _mm256_add_epi32 (_mm256_and_si256 (a, mask),
+      _mm256_srli_epi32 (a, 16));
+  sum = _mm256_add_epi32 (sum, _mm256_and_si256 (b, mask));
+  sum = _mm256_add_epi32 (sum, _mm256_srli_epi32 (b, 16));
+  return _mm256_srli_epi32 (_mm256_add_epi32 (sum, _mm256_set1_epi32 (2)),
+      2);
+}
+
+TARGET_AVX2 static void
+box16_avx2 (guint16 * dst, const guint16 * row0, const guint16 * row1,
+    int n)
+{
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i lo = _box16_pairs_avx2 (row0 + 2 * i, row1 + 2 * i);
+    __m256i hi = _box16_pairs_avx2 (row0 + 2 * i + 16, row1 + 2 * i + 16);
+    __m256i packed = _mm256_packus_epi32 (lo, hi);
+    packed = _mm256_permute4x64_epi64 (packed, 0xd8);
+    _mm256_storeu_si256 ((__m256i *) (dst + i), packed);
+  }
+  box16_scalar (dst + i, row0 + 2 * i, row1 + 2 * i, n - i);
+}
+
+static const CopyKernels kernels_avx2 = {
+  shr16_avx2, shl16_avx2, narrow_avx2, widen_avx2,
+  interleave8_avx2, interleave16_avx2, box8_avx2, box16_avx2
+};
+#endif
+
+static const CopyKernels *kernels = &kernels_scalar;
+
+static GstLibde265CopyImpl
+_gst_libde265_copy_detect (void)
+{
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2")) {
+    return GST_LIBDE265_COPY_IMPL_AVX2;
+  }
+  if (__builtin_cpu_supports ("sse2")) {
+    return GST_LIBDE265_COPY_IMPL_SSE2;
+  }
+#endif
+  return GST_LIBDE265_COPY_IMPL_SCALAR;
+}
+
+GstLibde265CopyImpl
+gst_libde265_copy_select (GstLibde265CopyImpl impl)
+{
+  GstLibde265CopyImpl supported = _gst_libde265_copy_detect ();
+  if (impl == GST_LIBDE265_COPY_IMPL_AUTO || impl > supported) {
+    impl = supported;
+  }
+
+  switch (impl) {
+#ifdef HAVE_X86_KERNELS
+    case GST_LIBDE265_COPY_IMPL_AVX2:
+      kernels = &kernels_avx2;
+      break;
+    case GST_LIBDE265_COPY_IMPL_SSE2:
+      kernels = &kernels_sse2;
+      break;
+#endif
+    default:
+      impl = GST_LIBDE265_COPY_IMPL_SCALAR;
+      kernels = &kernels_scalar;
+      break;
+  }
+  return impl;
+}
+
+const char *
+gst_libde265_copy_impl_name (GstLibde265CopyImpl impl)
+{
+  switch (impl) {
+    case GST_LIBDE265_COPY_IMPL_SCALAR:
+      return "scalar";
+    case GST_LIBDE265_COPY_IMPL_SSE2:
+      return "sse2";
+    case GST_LIBDE265_COPY_IMPL_AVX2:
+      return "avx2";
+    default:
+      return "auto";
+  }
+}
+
+void
+gst_libde265_copy_plane (guint8 * dst, int dst_stride,
+    const guint8 * src, int src_stride, int width, int height,
+    int src_bits, int dst_bits)
+{
+  int src_bytes = (src_bits + 7) / 8;
+  int dst_bytes = (dst_bits + 7) / 8;
+
+  if (src_bytes == 2 && dst_bytes == 2) {
+    // 16 bit -> 16 bit, shift to the output precision
+    ShiftRowFunc func = NULL;
+    int shift = 0;
+    if (src_bits > dst_bits) {
+      func = kernels->shr16;
+      shift = src_bits - dst_bits;
+    } else if (src_bits < dst_bits) {
+      func = kernels->shl16;
+      shift = dst_bits - src_bits;
+    }
+    if (func != NULL) {
+      while (height--) {
+        func ((guint16 *) dst, (const guint16 *) src, width, shift);
+        src += src_stride;
+        dst += dst_stride;
+      }
+      return;
+    }
+  } else if (src_bytes == 2) {
+    // 16 bit -> 8 bit
+    int shift = src_bits - dst_bits;
+    while (height--) {
+      kernels->narrow (dst, (const guint16 *) src, width, shift);
+      src += src_stride;
+      dst += dst_stride;
+    }
+    return;
+  } else if (dst_bytes == 2) {
+    // 8 bit -> 16 bit
+    int shift = dst_bits - src_bits;
+    while (height--) {
+      kernels->widen ((guint16 *) dst, src, width, shift);
+      src += src_stride;
+      dst += dst_stride;
+    }
+    return;
+  }
+
+  // Bits per pixel of image match output format. The C library memcpy is
+  // already runtime-dispatched to the best copy loop for the CPU.
+  int row_size = width * src_bytes;
+  if (src_stride == row_size && dst_stride == row_size) {
+    memcpy (dst, src, (size_t) height * row_size);
+  } else {
+    while (height--) {
+      memcpy (dst, src, row_size);
+      src += src_stride;
+      dst += dst_stride;
+    }
+  }
+}
+
+void
+gst_libde265_copy_interleave (guint8 * dst, int dst_stride,
+    const guint8 * src_u, int u_stride, const guint8 * src_v, int v_stride,
+    int width, int height, int src_bits, int dst_bits)
+{
+  int src_bytes = (src_bits + 7) / 8;
+  int dst_bytes = (dst_bits + 7) / 8;
+  int i;
+
+  if (src_bytes == 1 && dst_bytes == 1) {
+    while (height--) {
+      kernels->interleave8 (dst, src_u, src_v, width);
+      src_u += u_stride;
+      src_v += v_stride;
+      dst += dst_stride;
+    }
+  } else if (src_bytes == 2 && dst_bytes == 2 && dst_bits >= src_bits) {
+    while (height--) {
+      kernels->interleave16 ((guint16 *) dst, (const guint16 *) src_u,
+          (const guint16 *) src_v, width, dst_bits - src_bits);
+      src_u += u_stride;
+      src_v += v_stride;
+      dst += dst_stride;
+    }
+  } else {
+    // mixed sample sizes are not selected by the decoder, handle them
+    // sample by sample for completeness
+    while (height--) {
+      for (i = 0; i < width; i++) {
+        int u = src_bytes == 2 ? ((const guint16 *) src_u)[i] : src_u[i];
+        int v = src_bytes == 2 ? ((const guint16 *) src_v)[i] : src_v[i];
+        if (dst_bits > src_bits) {
+          u <<= dst_bits - src_bits;
+          v <<= dst_bits - src_bits;
+        } else {
+          u >>= src_bits - dst_bits;
+          v >>= src_bits - dst_bits;
+        }
+        if (dst_bytes == 2) {
+          ((guint16 *) dst)[2 * i] = u;
+          ((guint16 *) dst)[2 * i + 1] = v;
+        } else {
+          dst[2 * i] = u;
+          dst[2 * i + 1] = v;
+        }
+      }
+      src_u += u_stride;
+      src_v += v_stride;
+      dst += dst_stride;
+    }
+  }
+}
+
+// Downscale one row by 2 or 4 into dst, samples stay in the source format.
+// Output samples without a complete block in the source are taken from the
+// nearest source sample. "tmp" must hold 4 * dst_width samples.
+static void
+_gst_libde265_scale_row (guint8 * dst, const guint8 * src, int src_stride,
+    int src_width, int src_height, int y, int dst_width, int scale,
+    int bytes, guint8 * tmp)
+{
+  const guint8 *rows[4];
+  int full = MIN (dst_width, src_width / scale);
+  int i;
+
+  for (i = 0; i < scale; i++) {
+    rows[i] = src + (gsize) MIN (y * scale + i, src_height - 1) * src_stride;
+  }
+
+  if (bytes == 2) {
+    if (scale == 2) {
+      kernels->box16 ((guint16 *) dst, (const guint16 *) rows[0],
+          (const guint16 *) rows[1], full);
+    } else {
+      guint16 *half0 = (guint16 *) tmp;
+      guint16 *half1 = half0 + 2 * full;
+      kernels->box16 (half0, (const guint16 *) rows[0],
+          (const guint16 *) rows[1], 2 * full);
+      kernels->box16 (half1, (const guint16 *) rows[2],
+          (const guint16 *) rows[3], 2 * full);
+      kernels->box16 ((guint16 *) dst, half0, half1, full);
+    }
+    for (i = full; i < dst_width; i++) {
+      ((guint16 *) dst)[i] =
+          ((const guint16 *) rows[0])[MIN (i * scale, src_width - 1)];
+    }
+  } else {
+    if (scale == 2) {
+      kernels->box8 (dst, rows[0], rows[1], full);
+    } else {
+      guint8 *half0 = tmp;
+      guint8 *half1 = half0 + 2 * full;
+      kernels->box8 (half0, rows[0], rows[1], 2 * full);
+      kernels->box8 (half1, rows[2], rows[3], 2 * full);
+      kernels->box8 (dst, half0, half1, full);
+    }
+    for (i = full; i < dst_width; i++) {
+      dst[i] = rows[0][MIN (i * scale, src_width - 1)];
+    }
+  }
+}
+
+void
+gst_libde265_copy_plane_scaled (guint8 * dst, int dst_stride,
+    int dst_width, int dst_height, const guint8 * src, int src_stride,
+    int src_width, int src_height, int scale, int src_bits, int dst_bits,
+    guint8 * scratch)
+{
+  int bytes = (src_bits + 7) / 8;
+  int y;
+
+  if (scale <= 1) {
+    gst_libde265_copy_plane (dst, dst_stride, src, src_stride, dst_width,
+        dst_height, src_bits, dst_bits);
+    return;
+  }
+
+  // rows are scaled into a buffer that stays in the cache and then
+  // converted to the output format
+  guint8 *row = scratch;
+  guint8 *tmp = row + dst_width * bytes;
+  for (y = 0; y < dst_height; y++) {
+    _gst_libde265_scale_row (row, src, src_stride, src_width, src_height, y,
+        dst_width, scale, bytes, tmp);
+    gst_libde265_copy_plane (dst, dst_stride, row, 0, dst_width, 1, src_bits,
+        dst_bits);
+    dst += dst_stride;
+  }
+}
+
+void
+gst_libde265_copy_interleave_scaled (guint8 * dst, int dst_stride,
+    int dst_width, int dst_height, const guint8 * src_u, int u_stride,
+    const guint8 * src_v, int v_stride, int src_width, int src_height,
+    int scale, int src_bits, int dst_bits, guint8 * scratch)
+{
+  int bytes = (src_bits + 7) / 8;
+  int y;
+
+  if (scale <= 1) {
+    gst_libde265_copy_interleave (dst, dst_stride, src_u, u_stride, src_v,
+        v_stride, dst_width, dst_height, src_bits, dst_bits);
+    return;
+  }
+
+  guint8 *row_u = scratch;
+  guint8 *row_v = row_u + dst_width * bytes;
+  guint8 *tmp = row_v + dst_width * bytes;
+  for (y = 0; y < dst_height; y++) {
+    _gst_libde265_scale_row (row_u, src_u, u_stride, src_width, src_height,
+        y, dst_width, scale, bytes, tmp);
+    _gst_libde265_scale_row (row_v, src_v, v_stride, src_width, src_height,
+        y, dst_width, scale, bytes, tmp);
+    gst_libde265_copy_interleave (dst, dst_stride, row_u, 0, row_v, 0,
+        dst_width, 1, src_bits, dst_bits);
+    dst += dst_stride;
+  }
+}
+
+// scratch rows that fit on the stack of the copying threads, enough for
+// scaled output up to 2048 samples wide
+#define SCRATCH_STACK_BYTES GST_LIBDE265_COPY_SCRATCH_SIZE (2048, 16)
+
+typedef struct
+{
+  const GstLibde265CopyPlane *planes;
+  int scale;
+  int bands;
+  int tasks;
+  gint next;
+  // scratch rows for wider output, one slice per copying thread
+  gsize scratch_size;
+  guint8 *scratch;
+  gint slot;
+  GMutex lock;
+  GCond cond;
+  int helpers;
+} CopyJob;
+
+static GMutex pool_lock;
+static GThreadPool *pool = NULL;
+static int pool_workers = 0;
+
+static void
+_gst_libde265_copy_band (const GstLibde265CopyPlane * p, int scale, int band,
+    int bands, guint8 * scratch)
+{
+  int y0 = (gint64) p->dst_height * band / bands;
+  int y1 = (gint64) p->dst_height * (band + 1) / bands;
+  int src_y = y0 * MAX (scale, 1);
+  guint8 *dst = p->dst + (gsize) y0 * p->dst_stride;
+  const guint8 *src = p->src + (gsize) src_y * p->src_stride;
+
+  if (y1 <= y0) {
+    return;
+  }
+  if (p->src_v != NULL) {
+    gst_libde265_copy_interleave_scaled (dst, p->dst_stride, p->dst_width,
+        y1 - y0, src, p->src_stride,
+        p->src_v + (gsize) src_y * p->v_stride, p->v_stride, p->src_width,
+        p->src_height - src_y, scale, p->src_bits, p->dst_bits, scratch);
+  } else {
+    gst_libde265_copy_plane_scaled (dst, p->dst_stride, p->dst_width,
+        y1 - y0, src, p->src_stride, p->src_width, p->src_height - src_y,
+        scale, p->src_bits, p->dst_bits, scratch);
+  }
+}
+
+static void
+_gst_libde265_copy_run (CopyJob * job)
+{
+  // aligned for 16 bit samples
+  guint64 stack[SCRATCH_STACK_BYTES / sizeof (guint64)];
+  guint8 *scratch = (guint8 *) stack;
+  int task;
+
+  if (job->scratch != NULL) {
+    scratch = job->scratch +
+        (gsize) g_atomic_int_add (&job->slot, 1) * job->scratch_size;
+  }
+  while ((task = g_atomic_int_add (&job->next, 1)) < job->tasks) {
+    _gst_libde265_copy_band (&job->planes[task / job->bands], job->scale,
+        task % job->bands, job->bands, scratch);
+  }
+}
+
+static void
+_gst_libde265_copy_worker (gpointer data, gpointer user_data)
+{
+  CopyJob *job = (CopyJob *) data;
+  _gst_libde265_copy_run (job);
+  g_mutex_lock (&job->lock);
+  job->helpers--;
+  g_cond_signal (&job->cond);
+  g_mutex_unlock (&job->lock);
+}
+
+static GThreadPool *
+_gst_libde265_copy_get_pool (void)
+{
+  g_mutex_lock (&pool_lock);
+  if (pool == NULL) {
+    // the thread count is twice the number of cores, leave one core
+    // to the calling thread
+    pool_workers = CLAMP (gst_libde265_threads_auto_count () / 2 - 1, 0,
+        MAX_COPY_WORKERS);
+    if (pool_workers > 0) {
+      pool = g_thread_pool_new (_gst_libde265_copy_worker, NULL,
+          pool_workers, FALSE, NULL);
+    }
+  }
+  g_mutex_unlock (&pool_lock);
+  return pool;
+}
+
+int
+gst_libde265_copy_planes (const GstLibde265CopyPlane * planes, int n_planes,
+    int scale)
+{
+  CopyJob job;
+  gsize bytes = 0;
+  int bands = 1;
+  int i;
+
+  job.scratch_size = 0;
+  // memory traffic of the copy, scaled copies read more than they write
+  for (i = 0; i < n_planes; i++) {
+    const GstLibde265CopyPlane *p = &planes[i];
+    if (scale > 1) {
+      job.scratch_size = MAX (job.scratch_size,
+          GST_LIBDE265_COPY_SCRATCH_SIZE (p->dst_width, p->src_bits));
+    }
+    gsize src_bytes = (gsize) MIN (p->dst_height * MAX (scale, 1),
+        p->src_height) * ABS (p->src_stride);
+    bytes += (gsize) p->dst_height * ABS (p->dst_stride) +
+        (p->src_v != NULL ? 2 * src_bytes : src_bytes);
+  }
+  if (bytes >= 2 * PARALLEL_BAND_BYTES && _gst_libde265_copy_get_pool ()) {
+    bands = MIN (bytes / PARALLEL_BAND_BYTES, pool_workers + 1);
+  }
+  job.planes = planes;
+  job.scale = scale;
+  job.bands = bands;
+  job.tasks = n_planes * bands;
+  job.next = 0;
+  job.scratch = NULL;
+  job.slot = 0;
+  if (job.scratch_size > SCRATCH_STACK_BYTES) {
+    // at most one copying thread per band
+    job.scratch = g_malloc (job.scratch_size * bands);
+  }
+  if (bands <= 1) {
+    _gst_libde265_copy_run (&job);
+    g_free (job.scratch);
+    return 1;
+  }
+
+  job.helpers = 0;
+  g_mutex_init (&job.lock);
+  g_cond_init (&job.cond);
+  // the calling thread works on the bands, too
+  for (i = 0; i < bands - 1; i++) {
+    g_mutex_lock (&job.lock);
+    job.helpers++;
+    g_mutex_unlock (&job.lock);
+    if (!g_thread_pool_push (pool, &job, NULL)) {
+      g_mutex_lock (&job.lock);
+      job.helpers--;
+      g_mutex_unlock (&job.lock);
+      break;
+    }
+  }
+  _gst_libde265_copy_run (&job);
+  // workers may still be finishing their bands or not have started yet
+  g_mutex_lock (&job.lock);
+  while (job.helpers > 0) {
+    g_cond_wait (&job.cond, &job.lock);
+  }
+  g_mutex_unlock (&job.lock);
+  g_mutex_clear (&job.lock);
+  g_cond_clear (&job.cond);
+  g_free (job.scratch);
+  return bands;
+}
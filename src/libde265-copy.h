@@ -0,0 +1,113 @@
+/*
+ * GStreamer HEVC/H.265 video codec.
+ *
+ * Copyright (c) 2014 struktur AG, Joachim Bauch <bauch@struktur.de>
+ *
+ * This file is part of gstreamer-libde265.
+ *
+ * libde265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libde265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libde265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GST_LIBDE265_COPY_H__
+#define __GST_LIBDE265_COPY_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  GST_LIBDE265_COPY_IMPL_AUTO = -1,
+  GST_LIBDE265_COPY_IMPL_SCALAR = 0,
+  GST_LIBDE265_COPY_IMPL_SSE2,
+  GST_LIBDE265_COPY_IMPL_AVX2
+} GstLibde265CopyImpl;
+
+/*
+ * Select the row kernels used by gst_libde265_copy_plane. AUTO picks the
+ * best implementation supported by the running CPU, any other value is
+ * clamped to what the CPU supports. Returns the implementation in use.
+ * Must be called once before copying (the plugin does it on load).
+ */
+GstLibde265CopyImpl gst_libde265_copy_select (GstLibde265CopyImpl impl);
+
+const char *gst_libde265_copy_impl_name (GstLibde265CopyImpl impl);
+
+/*
+ * Copy "height" rows of "width" samples from src to dst, converting from
+ * src_bits to dst_bits per sample. Samples with more than 8 bits are stored
+ * as 16 bit words in native byte order. Strides are given in bytes.
+ */
+void gst_libde265_copy_plane (guint8 * dst, int dst_stride,
+    const guint8 * src, int src_stride, int width, int height,
+    int src_bits, int dst_bits);
+
+/*
+ * Interleave "height" rows of "width" samples from the two chroma planes
+ * src_u and src_v into dst, as used by semi-planar formats like NV12.
+ * Sample sizes and strides are handled as in gst_libde265_copy_plane.
+ */
+void gst_libde265_copy_interleave (guint8 * dst, int dst_stride,
+    const guint8 * src_u, int u_stride, const guint8 * src_v, int v_stride,
+    int width, int height, int src_bits, int dst_bits);
+
+/* Size of the scratch buffer the scaled copy functions need for rows of
+ * "width" output samples. */
+#define GST_LIBDE265_COPY_SCRATCH_SIZE(width, src_bits) \
+    ((gsize) 6 * (width) * (((src_bits) + 7) / 8))
+
+/*
+ * Variants of the functions above that downscale the source plane(s) of
+ * src_width x src_height samples by "scale" (1, 2 or 4) while copying.
+ * Blocks of scale x scale samples are averaged into one output sample.
+ * "scratch" must hold GST_LIBDE265_COPY_SCRATCH_SIZE (dst_width, src_bits)
+ * bytes, it is not used if "scale" is 1.
+ */
+void gst_libde265_copy_plane_scaled (guint8 * dst, int dst_stride,
+    int dst_width, int dst_height, const guint8 * src, int src_stride,
+    int src_width, int src_height, int scale, int src_bits, int dst_bits,
+    guint8 * scratch);
+void gst_libde265_copy_interleave_scaled (guint8 * dst, int dst_stride,
+    int dst_width, int dst_height, const guint8 * src_u, int u_stride,
+    const guint8 * src_v, int v_stride, int src_width, int src_height,
+    int scale, int src_bits, int dst_bits, guint8 * scratch);
+
+typedef struct
+{
+  guint8 *dst;
+  int dst_stride;
+  int dst_width;
+  int dst_height;
+  const guint8 *src;
+  int src_stride;
+  // second chroma plane for semi-planar output, NULL otherwise
+  const guint8 *src_v;
+  int v_stride;
+  int src_width;
+  int src_height;
+  int src_bits;
+  int dst_bits;
+} GstLibde265CopyPlane;
+
+/*
+ * Copy the planes of an image with the scaled copy functions above. Large
+ * images are split into bands of rows that are copied in parallel by a
+ * small worker pool shared by all decoders, smaller ones are copied in the
+ * calling thread. Returns the number of bands each plane was split into.
+ */
+int gst_libde265_copy_planes (const GstLibde265CopyPlane * planes,
+    int n_planes, int scale);
+
+G_END_DECLS
+
+#endif  // __GST_LIBDE265_COPY_H__
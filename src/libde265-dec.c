@@ -22,9 +22,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
 
 #include "libde265-dec.h"
+#include "libde265-copy.h"
+#include "libde265-threads.h"
+#include "libde265-pool.h"
+#include "libde265-memfd.h"
+#include "libde265-hugepage.h"
+
+#if GST_CHECK_VERSION(1,0,0)
+#include <gst/video/gstvideometa.h>
+#include <gst/video/gstvideopool.h>
+#endif
 
 #if !defined(LIBDE265_NUMERIC_VERSION) || LIBDE265_NUMERIC_VERSION < 0x00070000
 #error "You need libde265 0.7 or newer to compile this plugin."
@@ -35,9 +44,57 @@
 #define de265_get_bits_per_pixel(image, plane) 8
 #endif
 
-// use two decoder threads if no information about
-// available CPU cores can be retrieved
-#define DEFAULT_THREAD_COUNT        2
+// alignment of image planes required by libde265, updated from the
+// image specification passed to the allocation callbacks
+#define DEFAULT_ALIGNMENT           16
+
+// number of consecutive late frames before more pictures are skipped and
+// of frames in time before skipping is reduced again
+#define QOS_LATE_FRAMES             4
+#define QOS_RECOVER_FRAMES          30
+
+// if enabled, frames with at least this many NAL units that are this
+// small on average are passed to libde265 as one Annex-B block instead of
+// NAL by NAL
+#define BATCH_MIN_NALS              4
+#define BATCH_MAX_NAL_SIZE          4096
+
+// number of codec data variants whose parameter sets are kept, so streams
+// switching between a few renditions don't parse them again
+#define PARAM_SET_CACHE_SIZE        4
+
+// distinct in-band parameter sets of the stream that are kept to set up
+// a new decoder context in the middle of the stream
+#define PARAM_HISTORY_SIZE          32
+
+/*
+ * Parameter sets extracted from the codec data of the caps. They are kept
+ * as one Annex-B block, so they can be passed to libde265 again after a
+ * flush without parsing the codec data again.
+ */
+struct GstLibde265ParamSets
+{
+  guint hash;
+  guint8 *codec_data;
+  gsize codec_data_size;
+  GstLibde265DecMode mode;
+  int length_size;
+  GByteArray *nals;
+};
+
+#if GST_CHECK_VERSION(1,12,0)
+#define OUTPUT_FORMATS_12BIT    ", I420_12LE, I422_12LE, Y444_12LE"
+#else
+#define OUTPUT_FORMATS_12BIT
+#endif
+#if GST_CHECK_VERSION(1,10,0)
+#define OUTPUT_FORMATS_P010     ", P010_10LE"
+#else
+#define OUTPUT_FORMATS_P010
+#endif
+#define OUTPUT_FORMATS          "{ I420, Y42B, Y444, GRAY8, I420_10LE, " \
+    "I422_10LE, Y444_10LE, GRAY16_LE" OUTPUT_FORMATS_12BIT ", NV12, NV16" \
+    OUTPUT_FORMATS_P010 " }"
 
 #define parent_class gst_libde265_dec_parent_class
 G_DEFINE_TYPE (GstLibde265Dec, gst_libde265_dec, VIDEO_DECODER_TYPE);
@@ -53,7 +110,7 @@ static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
     GST_PAD_ALWAYS,
     GST_STATIC_CAPS (
 #if GST_CHECK_VERSION(1,0,0)
-        GST_VIDEO_CAPS_MAKE ("{ I420 }")
+        GST_VIDEO_CAPS_MAKE (OUTPUT_FORMATS)
 #else
         GST_VIDEO_CAPS_YUV ("{ I420 }")
 #endif
@@ -66,13 +123,45 @@ enum
   PROP_MODE,
   PROP_FRAMERATE,
   PROP_MAX_THREADS,
+  PROP_THREAD_BUDGET,
+  PROP_THREADS,
+  PROP_THREADS_AUTO_POLICY,
+  PROP_MAX_TEMPORAL_LAYER,
+  PROP_SKIP_FRAMES,
+  PROP_ASYNC_DEPTH,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+  PROP_LOW_LATENCY,
+  PROP_OUTPUT_SCALE,
+  PROP_OUTPUT_MEMORY,
+  PROP_HUGE_PAGES,
+  PROP_CONTEXT_POOL,
+  PROP_GOP_PARALLEL,
+  PROP_MAX_GOPS_IN_FLIGHT,
+  PROP_BATCH_NAL_UNITS,
   PROP_LAST
 };
 
-#define DEFAULT_MODE        GST_TYPE_LIBDE265_DEC_PACKETIZED
-#define DEFAULT_FPS_N       0
-#define DEFAULT_FPS_D       1
-#define DEFAULT_MAX_THREADS 0
+#define DEFAULT_MODE            GST_TYPE_LIBDE265_DEC_PACKETIZED
+#define DEFAULT_FPS_N           0
+#define DEFAULT_FPS_D           1
+#define DEFAULT_MAX_THREADS     0
+#define DEFAULT_THREAD_BUDGET   0
+#define DEFAULT_THREADS_POLICY  GST_TYPE_LIBDE265_DEC_THREADS_RESOLUTION
+#define DEFAULT_MAX_TEMPORAL_LAYER  -1
+#define DEFAULT_SKIP_FRAMES     GST_TYPE_LIBDE265_DEC_SKIP_NONE
+#define DEFAULT_ASYNC_DEPTH     0
+#define MAX_ASYNC_DEPTH         256
+#define DEFAULT_STATS_INTERVAL  0
+#define DEFAULT_LOW_LATENCY     FALSE
+#define DEFAULT_OUTPUT_SCALE    GST_TYPE_LIBDE265_DEC_SCALE_FULL
+#define DEFAULT_OUTPUT_MEMORY   GST_TYPE_LIBDE265_DEC_MEMORY_SYSTEM
+#define DEFAULT_HUGE_PAGES      FALSE
+#define DEFAULT_CONTEXT_POOL    0
+#define DEFAULT_GOP_PARALLEL    0
+#define MAX_GOP_PARALLEL        64
+#define DEFAULT_MAX_GOPS_IN_FLIGHT  0
+#define DEFAULT_BATCH_NAL_UNITS FALSE
 
 
 #define GST_TYPE_LIBDE265_DEC_MODE (gst_libde265_dec_mode_get_type ())
@@ -96,12 +185,103 @@ gst_libde265_dec_mode_get_type (void)
   return libde265_dec_mode_type;
 }
 
+#define GST_TYPE_LIBDE265_DEC_THREADS_POLICY \
+    (gst_libde265_dec_threads_policy_get_type ())
+static GType
+gst_libde265_dec_threads_policy_get_type (void)
+{
+  static GType libde265_dec_threads_policy_type = 0;
+  static const GEnumValue libde265_dec_threads_policy_types[] = {
+    {GST_TYPE_LIBDE265_DEC_THREADS_CORES,
+        "Twice the number of CPU cores", "cores"},
+    {GST_TYPE_LIBDE265_DEC_THREADS_RESOLUTION,
+          "Sized from the picture size and parallel decoding tools of the "
+          "stream, limited by the number of CPU cores", "resolution"},
+    {0, NULL, NULL}
+  };
+
+  if (!libde265_dec_threads_policy_type) {
+    libde265_dec_threads_policy_type =
+        g_enum_register_static ("GstLibde265DecThreadsPolicy",
+        libde265_dec_threads_policy_types);
+  }
+  return libde265_dec_threads_policy_type;
+}
+
+#define GST_TYPE_LIBDE265_DEC_SKIP_FRAMES \
+    (gst_libde265_dec_skip_frames_get_type ())
+static GType
+gst_libde265_dec_skip_frames_get_type (void)
+{
+  static GType libde265_dec_skip_frames_type = 0;
+  static const GEnumValue libde265_dec_skip_frames_types[] = {
+    {GST_TYPE_LIBDE265_DEC_SKIP_NONE, "Decode all frames", "none"},
+    {GST_TYPE_LIBDE265_DEC_SKIP_NON_IRAP,
+        "Only decode IRAP (IDR, CRA and BLA) frames", "non-irap"},
+    {0, NULL, NULL}
+  };
+
+  if (!libde265_dec_skip_frames_type) {
+    libde265_dec_skip_frames_type =
+        g_enum_register_static ("GstLibde265DecSkipFrames",
+        libde265_dec_skip_frames_types);
+  }
+  return libde265_dec_skip_frames_type;
+}
+
+#define GST_TYPE_LIBDE265_DEC_OUTPUT_SCALE \
+    (gst_libde265_dec_output_scale_get_type ())
+static GType
+gst_libde265_dec_output_scale_get_type (void)
+{
+  static GType libde265_dec_output_scale_type = 0;
+  static const GEnumValue libde265_dec_output_scale_types[] = {
+    {GST_TYPE_LIBDE265_DEC_SCALE_FULL, "Full resolution", "1"},
+    {GST_TYPE_LIBDE265_DEC_SCALE_HALF, "Half width and height", "1/2"},
+    {GST_TYPE_LIBDE265_DEC_SCALE_QUARTER, "Quarter width and height", "1/4"},
+    {0, NULL, NULL}
+  };
+
+  if (!libde265_dec_output_scale_type) {
+    libde265_dec_output_scale_type =
+        g_enum_register_static ("GstLibde265DecOutputScale",
+        libde265_dec_output_scale_types);
+  }
+  return libde265_dec_output_scale_type;
+}
+
+#ifdef HAVE_MEMFD_OUTPUT
+#define GST_TYPE_LIBDE265_DEC_OUTPUT_MEMORY \
+    (gst_libde265_dec_output_memory_get_type ())
+static GType
+gst_libde265_dec_output_memory_get_type (void)
+{
+  static GType libde265_dec_output_memory_type = 0;
+  static const GEnumValue libde265_dec_output_memory_types[] = {
+    {GST_TYPE_LIBDE265_DEC_MEMORY_SYSTEM,
+        "Memory provided by downstream or system memory", "system"},
+    {GST_TYPE_LIBDE265_DEC_MEMORY_MEMFD,
+        "Shared memory backed by memfd, can be passed to other processes",
+          "memfd"},
+    {0, NULL, NULL}
+  };
+
+  if (!libde265_dec_output_memory_type) {
+    libde265_dec_output_memory_type =
+        g_enum_register_static ("GstLibde265DecOutputMemory",
+        libde265_dec_output_memory_types);
+  }
+  return libde265_dec_output_memory_type;
+}
+#endif
+
 static void gst_libde265_dec_finalize (GObject * object);
 
 static void gst_libde265_dec_set_property (GObject * object, guint prop_id,
     const GValue * value, GParamSpec * pspec);
 static void gst_libde265_dec_get_property (GObject * object, guint prop_id,
     GValue * value, GParamSpec * pspec);
+static GstStructure *_gst_libde265_dec_get_stats (GstLibde265Dec * dec);
 
 static gboolean gst_libde265_dec_start (VIDEO_DECODER_BASE * parse);
 static gboolean gst_libde265_dec_stop (VIDEO_DECODER_BASE * parse);
@@ -115,10 +295,31 @@ static gboolean gst_libde265_dec_reset (VIDEO_DECODER_BASE * parse,
 #else
 static gboolean gst_libde265_dec_reset (VIDEO_DECODER_BASE * parse);
 #endif
+#if GST_CHECK_VERSION(1,0,0)
+static gboolean gst_libde265_dec_decide_allocation (VIDEO_DECODER_BASE * parse,
+    GstQuery * query);
+static GstFlowReturn gst_libde265_dec_finish (VIDEO_DECODER_BASE * parse);
+static GstFlowReturn gst_libde265_dec_parse (VIDEO_DECODER_BASE * parse,
+    VIDEO_FRAME * frame, GstAdapter * adapter, gboolean at_eos);
+static void _gst_libde265_dec_update_latency (GstLibde265Dec * dec);
+static GstFlowReturn _gst_libde265_dec_gop_drain_all (GstLibde265Dec * dec);
+static void _gst_libde265_dec_gop_discard (GstLibde265Dec * dec);
+static void _gst_libde265_dec_gop_stop (GstLibde265Dec * dec);
+#endif
+static GstFlowReturn _gst_libde265_dec_process_frame (VIDEO_DECODER_BASE *
+    parse, VIDEO_FRAME * frame);
 static GstFlowReturn gst_libde265_dec_handle_frame (VIDEO_DECODER_BASE * parse,
     VIDEO_FRAME * frame);
+static gboolean _gst_libde265_dec_decode_codec_data (GstLibde265Dec * dec);
+static gboolean _gst_libde265_dec_push_param_sets (GstLibde265Dec * dec);
+static gboolean _gst_libde265_dec_restore_param_sets (GstLibde265Dec * dec);
+static gboolean _gst_libde265_dec_context_outdated (GstLibde265Dec * dec);
+static void _gst_libde265_dec_update_tid (GstLibde265Dec * dec, int type,
+    int tid);
+static int _gst_libde265_dec_rate_divider (GstLibde265Dec * dec);
 static GstFlowReturn _gst_libde265_image_available (VIDEO_DECODER_BASE * parse,
-    int width, int height, GstVideoFormat format);
+    int width, int height, const struct de265_image_spec *spec,
+    GstVideoFormat format);
 
 static void
 gst_libde265_dec_class_init (GstLibde265DecClass * klass)
@@ -147,6 +348,127 @@ gst_libde265_dec_class_init (GstLibde265DecClass * klass)
           0, G_MAXINT, DEFAULT_MAX_THREADS,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_THREAD_BUDGET,
+      g_param_spec_int ("thread-budget", "Shared thread budget",
+          "Total number of worker threads shared by all decoders with a "
+          "budget, the most recently started decoder sets it. "
+          "(0 = no shared budget)",
+          0, G_MAXINT, DEFAULT_THREAD_BUDGET,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_CONTEXT_POOL,
+      g_param_spec_int ("context-pool", "Decoder context pool",
+          "Maximum number of idle decoder contexts kept with their worker "
+          "threads running by a process-wide pool. Decoders using the pool "
+          "borrow a context when they start and return it when they stop, "
+          "the most recently stopped decoder sets the limit. (0 = no pool)",
+          0, G_MAXINT, DEFAULT_CONTEXT_POOL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_THREADS,
+      g_param_spec_int ("threads", "Worker threads",
+          "Number of worker threads currently used by this decoder",
+          0, G_MAXINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_THREADS_AUTO_POLICY,
+      g_param_spec_enum ("threads-auto-policy", "Automatic thread policy",
+          "How the number of worker threads is chosen if max-threads is 0",
+          GST_TYPE_LIBDE265_DEC_THREADS_POLICY, DEFAULT_THREADS_POLICY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_TEMPORAL_LAYER,
+      g_param_spec_int ("max-temporal-layer", "Maximum temporal layer",
+          "Highest temporal sub-layer to decode, higher sub-layers are "
+          "skipped and the output frame rate is reduced accordingly. "
+          "(-1 = all)",
+          -1, GST_LIBDE265_MAX_SUB_LAYERS - 1, DEFAULT_MAX_TEMPORAL_LAYER,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_SKIP_FRAMES,
+      g_param_spec_enum ("skip-frames", "Skip frames",
+          "Frames that are not decoded, key unit trick mode seeks always "
+          "skip non-IRAP frames",
+          GST_TYPE_LIBDE265_DEC_SKIP_FRAMES, DEFAULT_SKIP_FRAMES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+#if GST_CHECK_VERSION(1,0,0)
+  g_object_class_install_property (gobject_class, PROP_ASYNC_DEPTH,
+      g_param_spec_int ("async-depth", "Asynchronous decoding queue depth",
+          "Number of input frames queued for a separate decoding thread, "
+          "takes effect when the element is started. "
+          "(0 = decode in the streaming thread)",
+          0, MAX_ASYNC_DEPTH, DEFAULT_ASYNC_DEPTH,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_GOP_PARALLEL,
+      g_param_spec_int ("gop-parallel", "Parallel GOP decoding",
+          "Number of GOPs decoded in parallel by separate decoder contexts "
+          "if the input is not live, adds latency of several GOPs. "
+          "(0 = disabled)",
+          0, MAX_GOP_PARALLEL, DEFAULT_GOP_PARALLEL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_GOPS_IN_FLIGHT,
+      g_param_spec_int ("max-gops-in-flight", "Max. GOPs in flight",
+          "Maximum number of GOPs that are decoded or wait for output in "
+          "parallel GOP decoding. (0 = one more than gop-parallel)",
+          0, G_MAXINT, DEFAULT_MAX_GOPS_IN_FLIGHT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+#endif
+
+  g_object_class_install_property (gobject_class, PROP_BATCH_NAL_UNITS,
+      g_param_spec_boolean ("batch-nal-units", "Batch NAL units",
+          "Pass the NAL units of frames with many small NAL units to "
+          "libde265 as one block instead of one by one",
+          DEFAULT_BATCH_NAL_UNITS, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Decoding statistics since the element was started, times are in "
+          "nanoseconds", GST_TYPE_STRUCTURE,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STATS_INTERVAL,
+      g_param_spec_uint ("stats-interval", "Statistics interval",
+          "Interval in milliseconds to post the statistics as element "
+          "message. (0 = disabled)",
+          0, G_MAXUINT, DEFAULT_STATS_INTERVAL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+#if GST_CHECK_VERSION(1,0,0)
+  g_object_class_install_property (gobject_class, PROP_LOW_LATENCY,
+      g_param_spec_boolean ("low-latency", "Low latency",
+          "Finish decoding a picture with its input frame and output "
+          "pictures as soon as the stream allows, requires frame aligned "
+          "input", DEFAULT_LOW_LATENCY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+#endif
+
+  g_object_class_install_property (gobject_class, PROP_OUTPUT_SCALE,
+      g_param_spec_enum ("output-scale", "Output scale",
+          "Size of the output frames relative to the decoded pictures, "
+          "pictures are downscaled with a box filter while copying them out",
+          GST_TYPE_LIBDE265_DEC_OUTPUT_SCALE, DEFAULT_OUTPUT_SCALE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+#ifdef HAVE_MEMFD_OUTPUT
+  g_object_class_install_property (gobject_class, PROP_OUTPUT_MEMORY,
+      g_param_spec_enum ("output-memory", "Output memory",
+          "Memory the frames are decoded into, takes effect with the next "
+          "allocation query",
+          GST_TYPE_LIBDE265_DEC_OUTPUT_MEMORY, DEFAULT_OUTPUT_MEMORY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+#endif
+
+#ifdef HAVE_HUGEPAGE_OUTPUT
+  g_object_class_install_property (gobject_class, PROP_HUGE_PAGES,
+      g_param_spec_boolean ("huge-pages", "Huge pages",
+          "Back output frames and decoded pictures with huge pages where "
+          "possible, the backing obtained is reported in the statistics. "
+          "Has no effect on memfd output memory",
+          DEFAULT_HUGE_PAGES, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+#endif
+
   decoder_class->start = GST_DEBUG_FUNCPTR (gst_libde265_dec_start);
   decoder_class->stop = GST_DEBUG_FUNCPTR (gst_libde265_dec_stop);
   decoder_class->set_format = GST_DEBUG_FUNCPTR (gst_libde265_dec_set_format);
@@ -154,6 +476,12 @@ gst_libde265_dec_class_init (GstLibde265DecClass * klass)
   decoder_class->flush = GST_DEBUG_FUNCPTR (gst_libde265_dec_flush);
 #else
   decoder_class->reset = GST_DEBUG_FUNCPTR (gst_libde265_dec_reset);
+#endif
+#if GST_CHECK_VERSION(1,0,0)
+  decoder_class->decide_allocation =
+      GST_DEBUG_FUNCPTR (gst_libde265_dec_decide_allocation);
+  decoder_class->finish = GST_DEBUG_FUNCPTR (gst_libde265_dec_finish);
+  decoder_class->parse = GST_DEBUG_FUNCPTR (gst_libde265_dec_parse);
 #endif
   decoder_class->handle_frame =
       GST_DEBUG_FUNCPTR (gst_libde265_dec_handle_frame);
@@ -176,13 +504,59 @@ _gst_libde265_dec_reset_decoder (GstLibde265Dec * dec)
   dec->ctx = NULL;
   dec->width = -1;
   dec->height = -1;
+  dec->coded_width = -1;
+  dec->coded_height = -1;
+  dec->crop_left = 0;
+  dec->crop_top = 0;
+  dec->alignment = DEFAULT_ALIGNMENT;
   dec->buffer_full = 0;
-  dec->codec_data = NULL;
-  dec->codec_data_size = 0;
+  dec->param_sets = NULL;
+  dec->param_set_cache = NULL;
+  dec->ctx_threads = 0;
+  dec->pooled_contexts = 0;
+  dec->threads_pending = FALSE;
+  dec->threads_resize = FALSE;
+  dec->have_sps = FALSE;
+  dec->have_pps = FALSE;
+  dec->qos_level = 0;
+  dec->qos_late = 0;
+  dec->qos_on_time = 0;
+  dec->highest_tid = GST_LIBDE265_MAX_SUB_LAYERS - 1;
+  dec->rate_divider = 1;
+  dec->raw_skipping = FALSE;
+  dec->no_rasl_output = TRUE;
+  dec->skip_rasl = FALSE;
+  dec->stats_posted = 0;
+  gst_libde265_timing_reset (&dec->frame_time);
+  dec->push_time = 0;
+  dec->decode_time = 0;
+  dec->convert_time = 0;
+  dec->parallel_copy_time = 0;
+  dec->parallel_copies = 0;
+  dec->buffer_full_events = 0;
+  dec->pending_nals = 0;
+  dec->batched_nals = 0;
 #if GST_CHECK_VERSION(1,0,0)
   dec->frame_number = -1;
+  dec->parse_have_vcl = FALSE;
   dec->input_state = NULL;
   dec->output_state = NULL;
+  dec->planar_format = GST_VIDEO_FORMAT_UNKNOWN;
+  dec->output_format = GST_VIDEO_FORMAT_UNKNOWN;
+  dec->use_crop_meta = FALSE;
+  dec->use_padding = FALSE;
+  dec->use_video_meta = FALSE;
+  dec->export_frames = FALSE;
+  dec->direct_frames = 0;
+  dec->fallback_frames = 0;
+  dec->semi_planar_frames = 0;
+  dec->exported_frames = 0;
+  dec->clipped_frames = 0;
+  dec->parallel_gops = 0;
+  dec->frame_ref_free = NULL;
+  dec->frame_ref_slabs = NULL;
+  dec->latency_min_frames = -1;
+  dec->latency_max_frames = -1;
 #endif
 }
 
@@ -192,8 +566,50 @@ gst_libde265_dec_init (GstLibde265Dec * dec)
   dec->mode = DEFAULT_MODE;
   dec->fps_n = DEFAULT_FPS_N;
   dec->fps_d = DEFAULT_FPS_D;
+  dec->max_temporal_layer = DEFAULT_MAX_TEMPORAL_LAYER;
+  dec->skip_frames = DEFAULT_SKIP_FRAMES;
+  dec->output_scale = DEFAULT_OUTPUT_SCALE;
+  dec->stats_interval = DEFAULT_STATS_INTERVAL;
+#if GST_CHECK_VERSION(1,0,0)
+  dec->async_depth = DEFAULT_ASYNC_DEPTH;
+  dec->low_latency = DEFAULT_LOW_LATENCY;
+  dec->output_memory = DEFAULT_OUTPUT_MEMORY;
+  dec->memfd_allocator = NULL;
+  dec->huge_pages = DEFAULT_HUGE_PAGES;
+  dec->hugepage_allocator = NULL;
+  dec->async_thread = NULL;
+  dec->async_queue = NULL;
+  g_mutex_init (&dec->async_lock);
+  g_cond_init (&dec->async_cond);
+  dec->gop_parallel = DEFAULT_GOP_PARALLEL;
+  dec->max_gops_in_flight = DEFAULT_MAX_GOPS_IN_FLIGHT;
+  dec->gop_checked = FALSE;
+  dec->gop_workers = NULL;
+  dec->gop_worker_count = 0;
+  dec->gop_leading = NULL;
+  dec->gop_flow = GST_FLOW_OK;
+  dec->gop_error = NULL;
+  dec->gop_pool = NULL;
+  gst_video_info_init (&dec->gop_info);
+  dec->gop_crop_meta = FALSE;
+  dec->gop_length = 0;
+  g_mutex_init (&dec->gop_lock);
+  g_cond_init (&dec->gop_cond);
+  g_queue_init (&dec->gops);
+  g_queue_init (&dec->gop_queue);
+#endif
   dec->max_threads = DEFAULT_MAX_THREADS;
+  dec->thread_budget = DEFAULT_THREAD_BUDGET;
+  dec->context_pool = DEFAULT_CONTEXT_POOL;
+  dec->threads = 0;
+  dec->threads_wanted = 0;
+  dec->threads_policy = DEFAULT_THREADS_POLICY;
   dec->length_size = 4;
+  dec->au_input = FALSE;
+  dec->batch_nal_units = DEFAULT_BATCH_NAL_UNITS;
+  dec->nal_arena = NULL;
+  dec->nal_arena_size = 0;
+  g_queue_init (&dec->param_history);
   _gst_libde265_dec_reset_decoder (dec);
 #if GST_CHECK_VERSION(1,0,0)
   gst_video_decoder_set_packetized (GST_VIDEO_DECODER (dec), TRUE);
@@ -202,14 +618,28 @@ gst_libde265_dec_init (GstLibde265Dec * dec)
 #endif
 }
 
+static void
+_gst_libde265_dec_free_param_sets (struct GstLibde265ParamSets *sets)
+{
+  g_free (sets->codec_data);
+  g_byte_array_unref (sets->nals);
+  g_free (sets);
+}
+
 static inline void
 _gst_libde265_dec_free_decoder (GstLibde265Dec * dec)
 {
   if (dec->ctx != NULL) {
     de265_free_decoder (dec->ctx);
   }
-  free (dec->codec_data);
+  g_list_free_full (dec->param_set_cache,
+      (GDestroyNotify) _gst_libde265_dec_free_param_sets);
+  while (!g_queue_is_empty (&dec->param_history)) {
+    g_bytes_unref (g_queue_pop_head (&dec->param_history));
+  }
 #if GST_CHECK_VERSION(1,0,0)
+  // freeing or resetting the context has returned all frame refs
+  g_slist_free_full (dec->frame_ref_slabs, g_free);
   if (dec->input_state != NULL) {
     gst_video_codec_state_unref (dec->input_state);
   }
@@ -226,6 +656,19 @@ gst_libde265_dec_finalize (GObject * object)
   GstLibde265Dec *dec = GST_LIBDE265_DEC (object);
 
   _gst_libde265_dec_free_decoder (dec);
+  g_free (dec->nal_arena);
+#if GST_CHECK_VERSION(1,0,0)
+  g_mutex_clear (&dec->async_lock);
+  g_cond_clear (&dec->async_cond);
+  g_mutex_clear (&dec->gop_lock);
+  g_cond_clear (&dec->gop_cond);
+  if (dec->memfd_allocator != NULL) {
+    gst_object_unref (dec->memfd_allocator);
+  }
+  if (dec->hugepage_allocator != NULL) {
+    gst_object_unref (dec->hugepage_allocator);
+  }
+#endif
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
@@ -254,11 +697,118 @@ gst_libde265_dec_set_property (GObject * object, guint prop_id,
         GST_DEBUG_OBJECT (dec, "Max. threads set to auto");
       }
       break;
+    case PROP_THREADS_AUTO_POLICY:
+      dec->threads_policy = g_value_get_enum (value);
+      break;
+    case PROP_MAX_TEMPORAL_LAYER:
+      // picked up by the streaming thread with the next picture
+      dec->max_temporal_layer = g_value_get_int (value);
+      GST_DEBUG ("Max. temporal layer set to %d", dec->max_temporal_layer);
+      break;
+    case PROP_SKIP_FRAMES:
+      dec->skip_frames = g_value_get_enum (value);
+      break;
+    case PROP_OUTPUT_SCALE:
+      // picked up by the streaming thread with the next picture
+      dec->output_scale = g_value_get_enum (value);
+      break;
+    case PROP_STATS_INTERVAL:
+      dec->stats_interval = g_value_get_uint (value);
+      break;
+    case PROP_BATCH_NAL_UNITS:
+      dec->batch_nal_units = g_value_get_boolean (value);
+      break;
+#if GST_CHECK_VERSION(1,0,0)
+    case PROP_ASYNC_DEPTH:
+      dec->async_depth = g_value_get_int (value);
+      break;
+    case PROP_LOW_LATENCY:
+      dec->low_latency = g_value_get_boolean (value);
+      break;
+    case PROP_GOP_PARALLEL:
+      // checked with the first frame after the element was started
+      dec->gop_parallel = g_value_get_int (value);
+      break;
+    case PROP_MAX_GOPS_IN_FLIGHT:
+      dec->max_gops_in_flight = g_value_get_int (value);
+      break;
+#endif
+#ifdef HAVE_MEMFD_OUTPUT
+    case PROP_OUTPUT_MEMORY:
+      dec->output_memory = g_value_get_enum (value);
+      // renegotiate the allocation with the next frame
+      gst_pad_mark_reconfigure (GST_VIDEO_DECODER_SRC_PAD (dec));
+      break;
+#endif
+#ifdef HAVE_HUGEPAGE_OUTPUT
+    case PROP_HUGE_PAGES:
+      dec->huge_pages = g_value_get_boolean (value);
+      gst_pad_mark_reconfigure (GST_VIDEO_DECODER_SRC_PAD (dec));
+      break;
+#endif
+    case PROP_THREAD_BUDGET:
+      dec->thread_budget = g_value_get_int (value);
+      GST_DEBUG_OBJECT (dec, "Thread budget set to %d", dec->thread_budget);
+      break;
+    case PROP_CONTEXT_POOL:
+      dec->context_pool = g_value_get_int (value);
+      break;
     default:
       break;
   }
 }
 
+/*
+ * The counters are only written by the thread that decodes, reading them
+ * from other threads may give a slightly inconsistent snapshot.
+ */
+static GstStructure *
+_gst_libde265_dec_get_stats (GstLibde265Dec * dec)
+{
+  const GstLibde265Timing *timing = &dec->frame_time;
+  GstStructure *stats = gst_structure_new ("libde265dec-stats",
+      "frames", G_TYPE_UINT64, timing->count,
+      "frame-time-min", G_TYPE_UINT64, timing->min * GST_USECOND,
+      "frame-time-avg", G_TYPE_UINT64,
+      timing->count ? timing->total * GST_USECOND / timing->count : 0,
+      "frame-time-p99", G_TYPE_UINT64,
+      gst_libde265_timing_percentile (timing, 99) * GST_USECOND,
+      "push-time", G_TYPE_UINT64, dec->push_time * GST_USECOND,
+      "decode-time", G_TYPE_UINT64, dec->decode_time * GST_USECOND,
+      "convert-time", G_TYPE_UINT64, dec->convert_time * GST_USECOND,
+      "parallel-copy-time", G_TYPE_UINT64,
+      dec->parallel_copy_time * GST_USECOND,
+      "parallel-copies", G_TYPE_UINT, dec->parallel_copies,
+      "buffer-full", G_TYPE_UINT, dec->buffer_full_events,
+      "batched-nal-units", G_TYPE_UINT, dec->batched_nals,
+      "pending-nal-units", G_TYPE_INT, dec->pending_nals,
+      "threads", G_TYPE_INT, dec->threads,
+      "pooled-contexts", G_TYPE_UINT, dec->pooled_contexts,
+      NULL);
+#if GST_CHECK_VERSION(1,0,0)
+  GList *frames = gst_video_decoder_get_frames (GST_VIDEO_DECODER (dec));
+  gst_structure_set (stats,
+      "direct-frames", G_TYPE_UINT, dec->direct_frames,
+      "copied-frames", G_TYPE_UINT, dec->fallback_frames,
+      "semi-planar-frames", G_TYPE_UINT, dec->semi_planar_frames,
+      "exported-frames", G_TYPE_UINT, dec->exported_frames,
+      "clipped-frames", G_TYPE_UINT, dec->clipped_frames,
+      "parallel-gops", G_TYPE_UINT, dec->parallel_gops,
+      "pending-frames", G_TYPE_UINT, g_list_length (frames), NULL);
+  g_list_free_full (frames, (GDestroyNotify) gst_video_codec_frame_unref);
+#ifdef HAVE_HUGEPAGE_OUTPUT
+  GstLibde265HugepageBacking backing = GST_LIBDE265_HUGEPAGE_NONE;
+  if (dec->hugepage_allocator != NULL) {
+    backing =
+        gst_libde265_hugepage_allocator_get_backing (dec->hugepage_allocator);
+  }
+  gst_structure_set (stats, "huge-page-backing", G_TYPE_STRING,
+      gst_libde265_hugepage_backing_name (backing), NULL);
+#endif
+#endif
+  return stats;
+}
+
 static void
 gst_libde265_dec_get_property (GObject * object, guint prop_id,
     GValue * value, GParamSpec * pspec)
@@ -275,17 +825,85 @@ gst_libde265_dec_get_property (GObject * object, guint prop_id,
     case PROP_MAX_THREADS:
       g_value_set_int (value, dec->max_threads);
       break;
+    case PROP_THREAD_BUDGET:
+      g_value_set_int (value, dec->thread_budget);
+      break;
+    case PROP_THREADS:
+      g_value_set_int (value, dec->threads);
+      break;
+    case PROP_THREADS_AUTO_POLICY:
+      g_value_set_enum (value, dec->threads_policy);
+      break;
+    case PROP_MAX_TEMPORAL_LAYER:
+      g_value_set_int (value, dec->max_temporal_layer);
+      break;
+    case PROP_SKIP_FRAMES:
+      g_value_set_enum (value, dec->skip_frames);
+      break;
+    case PROP_OUTPUT_SCALE:
+      g_value_set_enum (value, dec->output_scale);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value, _gst_libde265_dec_get_stats (dec));
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, dec->stats_interval);
+      break;
+    case PROP_BATCH_NAL_UNITS:
+      g_value_set_boolean (value, dec->batch_nal_units);
+      break;
+#if GST_CHECK_VERSION(1,0,0)
+    case PROP_ASYNC_DEPTH:
+      g_value_set_int (value, dec->async_depth);
+      break;
+    case PROP_LOW_LATENCY:
+      g_value_set_boolean (value, dec->low_latency);
+      break;
+    case PROP_GOP_PARALLEL:
+      g_value_set_int (value, dec->gop_parallel);
+      break;
+    case PROP_MAX_GOPS_IN_FLIGHT:
+      g_value_set_int (value, dec->max_gops_in_flight);
+      break;
+#endif
+#ifdef HAVE_MEMFD_OUTPUT
+    case PROP_OUTPUT_MEMORY:
+      g_value_set_enum (value, dec->output_memory);
+      break;
+#endif
+#ifdef HAVE_HUGEPAGE_OUTPUT
+    case PROP_HUGE_PAGES:
+      g_value_set_boolean (value, dec->huge_pages);
+      break;
+#endif
     default:
       break;
   }
 }
 
+#if GST_CHECK_VERSION(1,12,0)
+#define GST_VIDEO_FORMAT_I420_HIGHEST   GST_VIDEO_FORMAT_I420_12LE
+#define GST_VIDEO_FORMAT_I422_HIGHEST   GST_VIDEO_FORMAT_I422_12LE
+#define GST_VIDEO_FORMAT_Y444_HIGHEST   GST_VIDEO_FORMAT_Y444_12LE
+#else
+#define GST_VIDEO_FORMAT_I420_HIGHEST   GST_VIDEO_FORMAT_I420_10LE
+#define GST_VIDEO_FORMAT_I422_HIGHEST   GST_VIDEO_FORMAT_I422_10LE
+#define GST_VIDEO_FORMAT_Y444_HIGHEST   GST_VIDEO_FORMAT_Y444_10LE
+#endif
+
 static inline GstVideoFormat
 _gst_libde265_get_video_format (enum de265_chroma chroma, int bits_per_pixel)
 {
   GstVideoFormat result = GST_VIDEO_FORMAT_UNKNOWN;
   switch (chroma) {
     case de265_chroma_mono:
+#if GST_CHECK_VERSION(1,0,0)
+      if (bits_per_pixel > 8 && bits_per_pixel <= 16) {
+        // samples are shifted to the full 16 bit range
+        result = GST_VIDEO_FORMAT_GRAY16_LE;
+        break;
+      }
+#endif
       result = GST_VIDEO_FORMAT_GRAY8;
       break;
     case de265_chroma_420:
@@ -300,9 +918,15 @@ _gst_libde265_get_video_format (enum de265_chroma chroma, int bits_per_pixel)
         case 10:
           result = GST_VIDEO_FORMAT_I420_10LE;
           break;
+#if GST_CHECK_VERSION(1,12,0)
+        case 11:
+        case 12:
+          result = GST_VIDEO_FORMAT_I420_12LE;
+          break;
+#endif
         default:
           if (bits_per_pixel > 10 && bits_per_pixel <= 16) {
-            result = GST_VIDEO_FORMAT_I420_10LE;
+            result = GST_VIDEO_FORMAT_I420_HIGHEST;
           } else {
             GST_DEBUG
                 ("Unsupported output colorspace %d with %d bits per pixel",
@@ -326,9 +950,15 @@ _gst_libde265_get_video_format (enum de265_chroma chroma, int bits_per_pixel)
         case 10:
           result = GST_VIDEO_FORMAT_I422_10LE;
           break;
+#if GST_CHECK_VERSION(1,12,0)
+        case 11:
+        case 12:
+          result = GST_VIDEO_FORMAT_I422_12LE;
+          break;
+#endif
         default:
           if (bits_per_pixel > 10 && bits_per_pixel <= 16) {
-            result = GST_VIDEO_FORMAT_I422_10LE;
+            result = GST_VIDEO_FORMAT_I422_HIGHEST;
           } else {
             GST_DEBUG
                 ("Unsupported output colorspace %d with %d bits per pixel",
@@ -352,9 +982,15 @@ _gst_libde265_get_video_format (enum de265_chroma chroma, int bits_per_pixel)
         case 10:
           result = GST_VIDEO_FORMAT_Y444_10LE;
           break;
+#if GST_CHECK_VERSION(1,12,0)
+        case 11:
+        case 12:
+          result = GST_VIDEO_FORMAT_Y444_12LE;
+          break;
+#endif
         default:
           if (bits_per_pixel > 10 && bits_per_pixel <= 16) {
-            result = GST_VIDEO_FORMAT_Y444_10LE;
+            result = GST_VIDEO_FORMAT_Y444_HIGHEST;
           } else {
             GST_DEBUG
                 ("Unsupported output colorspace %d with %d bits per pixel",
@@ -373,6 +1009,72 @@ _gst_libde265_get_video_format (enum de265_chroma chroma, int bits_per_pixel)
   return result;
 }
 
+#if GST_CHECK_VERSION(1,0,0)
+static inline GstVideoFormat
+_gst_libde265_get_semi_planar_format (GstVideoFormat format)
+{
+  switch (format) {
+    case GST_VIDEO_FORMAT_I420:
+      return GST_VIDEO_FORMAT_NV12;
+    case GST_VIDEO_FORMAT_Y42B:
+      return GST_VIDEO_FORMAT_NV16;
+#if GST_CHECK_VERSION(1,10,0)
+    case GST_VIDEO_FORMAT_I420_10LE:
+      return GST_VIDEO_FORMAT_P010_10LE;
+#endif
+    default:
+      return GST_VIDEO_FORMAT_UNKNOWN;
+  }
+}
+
+/*
+ * libde265 always decodes to planar formats. Output the semi-planar
+ * variant instead if downstream doesn't accept the planar format, the
+ * chroma planes are then interleaved while copying the image. Planar
+ * output is kept otherwise, as it can be rendered directly.
+ */
+static GstVideoFormat
+_gst_libde265_dec_output_format (GstLibde265Dec * dec, GstVideoFormat format)
+{
+  GstVideoFormat semi_planar = _gst_libde265_get_semi_planar_format (format);
+  if (semi_planar == GST_VIDEO_FORMAT_UNKNOWN) {
+    return format;
+  }
+  if (format == dec->planar_format) {
+    return dec->output_format;
+  }
+
+  gchar *filter_desc =
+      g_strdup_printf ("video/x-raw, format=(string){ %s, %s }",
+      gst_video_format_to_string (format),
+      gst_video_format_to_string (semi_planar));
+  GstCaps *filter = gst_caps_from_string (filter_desc);
+  g_free (filter_desc);
+  GstCaps *caps =
+      gst_pad_peer_query_caps (GST_VIDEO_DECODER_SRC_PAD (dec), filter);
+  gst_caps_unref (filter);
+
+  GstVideoFormat result = format;
+  if (caps != NULL && !gst_caps_is_empty (caps)) {
+    GstCaps *planar = gst_caps_new_simple ("video/x-raw",
+        "format", G_TYPE_STRING, gst_video_format_to_string (format), NULL);
+    if (!gst_caps_can_intersect (caps, planar)) {
+      result = semi_planar;
+    }
+    gst_caps_unref (planar);
+  }
+  if (caps != NULL) {
+    gst_caps_unref (caps);
+  }
+
+  GST_DEBUG_OBJECT (dec, "Using %s output for %s images",
+      gst_video_format_to_string (result), gst_video_format_to_string (format));
+  dec->planar_format = format;
+  dec->output_format = result;
+  return result;
+}
+#endif
+
 /*
  * Direct rendering code needs GStreamer 1.0
  * to have support for refcounted frames.
@@ -385,8 +1087,12 @@ struct GstLibde265FrameRef
   GstVideoFrame vframe;
   GstBuffer *buffer;
   int mapped;
+  struct GstLibde265FrameRef *next;
 };
 
+// used if no SPS has been parsed yet, the maximum DPB size of HEVC
+#define DEFAULT_FRAME_REFS      16
+
 static inline enum de265_chroma
 _gst_libde265_image_format_to_chroma (enum de265_image_format format)
 {
@@ -405,69 +1111,359 @@ _gst_libde265_image_format_to_chroma (enum de265_image_format format)
   }
 }
 
+static void
+_gst_libde265_dec_set_crop (GstBuffer * buffer, int x, int y, int width,
+    int height)
+{
+  GstVideoCropMeta *crop = gst_buffer_get_video_crop_meta (buffer);
+  if (crop == NULL) {
+    crop = gst_buffer_add_video_crop_meta (buffer);
+  }
+  crop->x = x;
+  crop->y = y;
+  crop->width = width;
+  crop->height = height;
+}
+
+/*
+ * Frame refs are kept in a lock-free free list. They are only taken by
+ * get_buffer in the thread that is decoding, but can be returned from any
+ * thread. With a single thread removing entries, the list is not affected
+ * by the ABA problem.
+ */
+static void
+_gst_libde265_dec_return_frame_ref (GstLibde265Dec * dec,
+    struct GstLibde265FrameRef *ref)
+{
+  struct GstLibde265FrameRef *head;
+  do {
+    head = g_atomic_pointer_get (&dec->frame_ref_free);
+    ref->next = head;
+  } while (!g_atomic_pointer_compare_and_exchange (&dec->frame_ref_free,
+          head, ref));
+}
+
+static struct GstLibde265FrameRef *
+_gst_libde265_dec_take_frame_ref (GstLibde265Dec * dec)
+{
+  struct GstLibde265FrameRef *ref;
+  do {
+    ref = g_atomic_pointer_get (&dec->frame_ref_free);
+    if (ref == NULL) {
+      // allocate enough refs for a full DPB at once
+      int count = DEFAULT_FRAME_REFS;
+      int i;
+      if (dec->have_sps) {
+        count = dec->sps.max_dec_pic_buffering[dec->sps.max_sub_layers - 1]
+            + 1;
+      }
+      ref = g_new0 (struct GstLibde265FrameRef, count);
+      dec->frame_ref_slabs = g_slist_prepend (dec->frame_ref_slabs, ref);
+      GST_DEBUG_OBJECT (dec, "Allocated %d frame refs", count);
+      for (i = 1; i < count; i++) {
+        _gst_libde265_dec_return_frame_ref (dec, &ref[i]);
+      }
+      return ref;
+    }
+  } while (!g_atomic_pointer_compare_and_exchange (&dec->frame_ref_free, ref,
+          ref->next));
+  ref->next = NULL;
+  return ref;
+}
+
 static void
 gst_libde265_dec_release_frame_ref (struct GstLibde265FrameRef *ref)
 {
   if (ref->mapped) {
     gst_video_frame_unmap (&ref->vframe);
+    ref->mapped = FALSE;
+  }
+  if (ref->frame != NULL) {
+    gst_video_codec_frame_unref (ref->frame);
+    ref->frame = NULL;
   }
-  gst_video_codec_frame_unref (ref->frame);
   gst_buffer_replace (&ref->buffer, NULL);
-  g_free (ref);
+  _gst_libde265_dec_return_frame_ref (GST_LIBDE265_DEC (ref->decoder), ref);
 }
 
-static int
-gst_libde265_dec_get_buffer (de265_decoder_context * ctx,
-    struct de265_image_spec *spec, struct de265_image *img, void *userdata)
+/*
+ * Check if a frame lies outside the input segment, e.g. ahead of the
+ * target of an accurate seek. The base class drops such frames, so they
+ * are only decoded if other pictures reference them.
+ */
+static gboolean
+_gst_libde265_dec_is_clipped (GstLibde265Dec * dec, GstClockTime pts,
+    GstClockTime duration)
 {
-  VIDEO_DECODER_BASE *base = (VIDEO_DECODER_BASE *) userdata;
-  GstLibde265Dec *dec = GST_LIBDE265_DEC (base);
-  VIDEO_FRAME *frame;
-  int i;
+  GstSegment *segment = &GST_VIDEO_DECODER (dec)->input_segment;
+  GstClockTime stop = pts;
 
-  frame = GET_FRAME (base, dec->frame_number);
-  if (G_UNLIKELY (frame == NULL)) {
-    // should not happen...
-    GST_WARNING_OBJECT (base, "Couldn't get codec frame !");
-    goto fallback;
+  if (!GST_CLOCK_TIME_IS_VALID (pts) || segment->format != GST_FORMAT_TIME) {
+    return FALSE;
   }
+  if (GST_CLOCK_TIME_IS_VALID (duration)) {
+    stop += duration;
+  }
+  return !gst_segment_clip (segment, GST_FORMAT_TIME, pts, stop, NULL, NULL);
+}
 
-  GST_VIDEO_CODEC_FRAME_FLAG_UNSET (frame,
+// user data of frames that were already decode-only when they were received
+#define UPSTREAM_DECODE_ONLY  GINT_TO_POINTER (1)
+
+/*
+ * Frames stay decode-only until a picture is output with them, so frames
+ * without a picture are dropped. Remember if upstream or the base class
+ * already decided that, the flag must not be cleared for those frames.
+ */
+static void
+_gst_libde265_dec_mark_decode_only (VIDEO_FRAME * frame)
+{
+  if (GST_VIDEO_CODEC_FRAME_IS_DECODE_ONLY (frame)) {
+    gst_video_codec_frame_set_user_data (frame, UPSTREAM_DECODE_ONLY, NULL);
+  }
+  GST_VIDEO_CODEC_FRAME_FLAG_SET (frame,
       GST_VIDEO_CODEC_FRAME_FLAG_DECODE_ONLY);
+}
 
-  int width =
-      (spec->width + spec->alignment - 1) / spec->alignment * spec->alignment;
-  int height = spec->height;
+static inline gboolean
+_gst_libde265_dec_upstream_decode_only (VIDEO_FRAME * frame)
+{
+  return gst_video_codec_frame_get_user_data (frame) == UPSTREAM_DECODE_ONLY;
+}
 
-  if (width != spec->visible_width || height != spec->visible_height) {
-    // clipping not supported for now
-    goto fallback;
-  }
+/*
+ * Pictures are output with the oldest pending frame, which is not the
+ * frame they were decoded from if pictures are reordered. Find that frame
+ * by the timestamp of the picture, NULL if there is none.
+ */
+static VIDEO_FRAME *
+_gst_libde265_dec_find_source_frame (GstLibde265Dec * dec, GstClockTime pts)
+{
+  VIDEO_FRAME *result = NULL;
+  GList *frames, *walk;
 
-  enum de265_chroma chroma =
-      _gst_libde265_image_format_to_chroma (spec->format);
-  if (chroma != de265_chroma_mono) {
-    if (de265_get_bits_per_pixel (img, 0) != de265_get_bits_per_pixel (img, 1)
-        || de265_get_bits_per_pixel (img, 0) != de265_get_bits_per_pixel (img,
-            2)
-        || de265_get_bits_per_pixel (img, 1) != de265_get_bits_per_pixel (img,
-            2)) {
-      GST_DEBUG_OBJECT (dec,
-          "input format has multiple bits per pixel (%d/%d/%d)",
-          de265_get_bits_per_pixel (img, 0), de265_get_bits_per_pixel (img, 1),
-          de265_get_bits_per_pixel (img, 2));
-      goto fallback;
+  if (!GST_CLOCK_TIME_IS_VALID (pts)) {
+    return NULL;
+  }
+  frames = gst_video_decoder_get_frames (GST_VIDEO_DECODER (dec));
+  for (walk = frames; walk != NULL; walk = walk->next) {
+    VIDEO_FRAME *frame = (VIDEO_FRAME *) walk->data;
+    if (FRAME_PTS (frame) == pts) {
+      result = gst_video_codec_frame_ref (frame);
+      break;
     }
   }
+  g_list_free_full (frames, (GDestroyNotify) gst_video_codec_frame_unref);
+  return result;
+}
 
-  int bits_per_pixel = de265_get_bits_per_pixel (img, 0);
-  GstVideoFormat format =
+/*
+ * Return the allocator for the memory selected by the properties, NULL to
+ * use the memory of downstream or system memory.
+ */
+static GstAllocator *
+_gst_libde265_dec_own_allocator (GstLibde265Dec * dec)
+{
+#ifdef HAVE_MEMFD_OUTPUT
+  if (dec->output_memory == GST_TYPE_LIBDE265_DEC_MEMORY_MEMFD) {
+    if (dec->memfd_allocator == NULL) {
+      dec->memfd_allocator = gst_libde265_memfd_allocator_new ();
+    }
+    return dec->memfd_allocator;
+  }
+#endif
+#ifdef HAVE_HUGEPAGE_OUTPUT
+  if (dec->huge_pages) {
+    if (dec->hugepage_allocator == NULL) {
+      dec->hugepage_allocator = gst_libde265_hugepage_allocator_new ();
+    }
+    return dec->hugepage_allocator;
+  }
+#endif
+  return NULL;
+}
+
+/*
+ * Allocate a buffer in system memory for the coded picture, laid out as
+ * libde265 needs it. The visible area is described by a GstVideoMeta, so
+ * downstream that supports the meta gets the picture without a copy even
+ * if its own buffers can't be used for direct rendering.
+ */
+static GstBuffer *
+_gst_libde265_dec_alloc_exported (GstLibde265Dec * dec,
+    const struct de265_image_spec *spec, GstVideoFormat format)
+{
+  GstVideoInfo info;
+  GstVideoAlignment align;
+  GstAllocationParams params;
+  gsize offset[GST_VIDEO_MAX_PLANES];
+  gint stride[GST_VIDEO_MAX_PLANES];
+  int i;
+
+  gst_video_info_set_format (&info, format, spec->width, spec->height);
+  gst_video_alignment_reset (&align);
+  for (i = 0; i < GST_VIDEO_MAX_PLANES; i++) {
+    align.stride_align[i] = spec->alignment - 1;
+  }
+  gst_video_info_align (&info, &align);
+
+  gst_allocation_params_init (&params);
+  params.align = spec->alignment - 1;
+  GstBuffer *buffer =
+      gst_buffer_new_allocate (_gst_libde265_dec_own_allocator (dec),
+      GST_VIDEO_INFO_SIZE (&info), &params);
+  if (buffer == NULL) {
+    return NULL;
+  }
+
+  const GstVideoFormatInfo *finfo = info.finfo;
+  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (&info); i++) {
+    stride[i] = GST_VIDEO_INFO_PLANE_STRIDE (&info, i);
+    offset[i] = GST_VIDEO_INFO_PLANE_OFFSET (&info, i)
+        + GST_VIDEO_SUB_SCALE (GST_VIDEO_FORMAT_INFO_H_SUB (finfo, i),
+        spec->crop_top) * stride[i]
+        + GST_VIDEO_SUB_SCALE (GST_VIDEO_FORMAT_INFO_W_SUB (finfo, i),
+        spec->crop_left) * GST_VIDEO_FORMAT_INFO_PSTRIDE (finfo, i);
+  }
+  gst_buffer_add_video_meta_full (buffer, GST_VIDEO_FRAME_FLAG_NONE, format,
+      spec->visible_width, spec->visible_height,
+      GST_VIDEO_INFO_N_PLANES (&info), offset, stride);
+  return buffer;
+}
+
+#ifdef HAVE_HUGEPAGE_OUTPUT
+/*
+ * Allocate a picture that is only used for decoding from huge pages, its
+ * contents are copied to the output frame later. Returns FALSE to let
+ * libde265 allocate the picture itself.
+ */
+static gboolean
+_gst_libde265_dec_alloc_hugepage_picture (GstLibde265Dec * dec,
+    const struct de265_image_spec *spec, struct de265_image *img)
+{
+  enum de265_chroma chroma =
+      _gst_libde265_image_format_to_chroma (spec->format);
+  int bits_per_pixel = de265_get_bits_per_pixel (img, 0);
+  int n_planes = chroma == de265_chroma_mono ? 1 : 3;
+  int i;
+
+  for (i = 1; i < n_planes; i++) {
+    if (de265_get_bits_per_pixel (img, i) != bits_per_pixel) {
+      return FALSE;
+    }
+  }
+  GstVideoFormat format =
+      _gst_libde265_get_video_format (chroma, bits_per_pixel);
+  if (format == GST_VIDEO_FORMAT_UNKNOWN) {
+    return FALSE;
+  }
+
+  struct GstLibde265FrameRef *ref = _gst_libde265_dec_take_frame_ref (dec);
+  ref->decoder = GST_VIDEO_DECODER (dec);
+  ref->buffer = _gst_libde265_dec_alloc_exported (dec, spec, format);
+  if (ref->buffer == NULL) {
+    goto error;
+  }
+
+  GstVideoInfo info;
+  gst_video_info_set_format (&info, format, spec->visible_width,
+      spec->visible_height);
+  if (!gst_video_frame_map (&ref->vframe, &info, ref->buffer,
+          GST_MAP_READWRITE)) {
+    goto error;
+  }
+  ref->mapped = TRUE;
+
+  const GstVideoFormatInfo *finfo = info.finfo;
+  for (i = 0; i < n_planes; i++) {
+    int stride = GST_VIDEO_FRAME_PLANE_STRIDE (&ref->vframe, i);
+    // the video meta describes the visible area
+    uint8_t *data = GST_VIDEO_FRAME_PLANE_DATA (&ref->vframe, i);
+    data -= GST_VIDEO_SUB_SCALE (GST_VIDEO_FORMAT_INFO_H_SUB (finfo, i),
+        spec->crop_top) * stride;
+    data -= GST_VIDEO_SUB_SCALE (GST_VIDEO_FORMAT_INFO_W_SUB (finfo, i),
+        spec->crop_left) * GST_VIDEO_FRAME_COMP_PSTRIDE (&ref->vframe, i);
+    de265_set_image_plane (img, i, data, stride, ref);
+  }
+  return TRUE;
+
+error:
+  GST_WARNING_OBJECT (dec, "Failed to allocate picture from huge pages");
+  gst_libde265_dec_release_frame_ref (ref);
+  return FALSE;
+}
+#endif
+
+static int
+gst_libde265_dec_get_buffer (de265_decoder_context * ctx,
+    struct de265_image_spec *spec, struct de265_image *img, void *userdata)
+{
+  VIDEO_DECODER_BASE *base = (VIDEO_DECODER_BASE *) userdata;
+  GstLibde265Dec *dec = GST_LIBDE265_DEC (base);
+  VIDEO_FRAME *frame;
+  int i;
+
+  frame = GET_FRAME (base, dec->frame_number);
+  if (G_UNLIKELY (frame == NULL)) {
+    // should not happen...
+    GST_WARNING_OBJECT (base, "Couldn't get codec frame !");
+    goto fallback;
+  }
+
+  if (_gst_libde265_dec_upstream_decode_only (frame)
+      || _gst_libde265_dec_is_clipped (dec, FRAME_PTS (frame),
+          FRAME_DURATION (frame))) {
+    // the picture is only decoded to be referenced, don't use an output
+    // buffer for it
+    gst_video_codec_frame_unref (frame);
+    goto decode_only;
+  }
+
+  GST_VIDEO_CODEC_FRAME_FLAG_UNSET (frame,
+      GST_VIDEO_CODEC_FRAME_FLAG_DECODE_ONLY);
+
+  int width = spec->width;
+  int height = spec->height;
+  gboolean crop = (width != spec->visible_width
+      || height != spec->visible_height);
+
+  enum de265_chroma chroma =
+      _gst_libde265_image_format_to_chroma (spec->format);
+  if (chroma != de265_chroma_mono) {
+    if (de265_get_bits_per_pixel (img, 0) != de265_get_bits_per_pixel (img, 1)
+        || de265_get_bits_per_pixel (img, 0) != de265_get_bits_per_pixel (img,
+            2)
+        || de265_get_bits_per_pixel (img, 1) != de265_get_bits_per_pixel (img,
+            2)) {
+      GST_DEBUG_OBJECT (dec,
+          "input format has multiple bits per pixel (%d/%d/%d)",
+          de265_get_bits_per_pixel (img, 0), de265_get_bits_per_pixel (img, 1),
+          de265_get_bits_per_pixel (img, 2));
+      goto fallback;
+    }
+  }
+
+  if (dec->output_scale != GST_TYPE_LIBDE265_DEC_SCALE_FULL) {
+    GST_DEBUG_OBJECT (dec, "output is scaled while copying");
+    goto fallback;
+  }
+
+  int bits_per_pixel = de265_get_bits_per_pixel (img, 0);
+  GstVideoFormat format =
       _gst_libde265_get_video_format (chroma, bits_per_pixel);
   if (format == GST_VIDEO_FORMAT_UNKNOWN) {
     goto fallback;
   }
 
+  format = _gst_libde265_dec_output_format (dec, format);
   const GstVideoFormatInfo *format_info = gst_video_format_get_info (format);
+  if (GST_VIDEO_FORMAT_INFO_N_PLANES (format_info) != 3
+      && chroma != de265_chroma_mono) {
+    GST_DEBUG_OBJECT (dec, "output format %s is not planar",
+        GST_VIDEO_FORMAT_INFO_NAME (format_info));
+    dec->semi_planar_frames++;
+    goto fallback;
+  }
   if (GST_VIDEO_FORMAT_INFO_BITS (format_info) != bits_per_pixel) {
     GST_DEBUG_OBJECT (dec,
         "output format doesn't provide enough bits per pixel (%d/%d)",
@@ -475,27 +1471,52 @@ gst_libde265_dec_get_buffer (de265_decoder_context * ctx,
     goto fallback;
   }
 
-  GstFlowReturn ret = _gst_libde265_image_available (base, width, height,
-      format);
+  GstFlowReturn ret = _gst_libde265_image_available (base,
+      spec->visible_width, spec->visible_height, spec, format);
   if (G_UNLIKELY (ret != GST_FLOW_OK)) {
     GST_ERROR_OBJECT (dec, "Failed to notify about available image");
     goto fallback;
   }
 
-  ret = ALLOC_OUTPUT_FRAME (GST_VIDEO_DECODER (dec), frame);
-  if (G_UNLIKELY (ret != GST_FLOW_OK)) {
-    GST_ERROR_OBJECT (dec, "Failed to allocate output buffer");
+  // use own buffers if those of downstream can't hold the coded picture
+  gboolean exported = dec->export_frames
+      || (crop && !dec->use_crop_meta && !dec->use_padding);
+  if (exported && !dec->use_video_meta) {
+    // downstream can't handle the padding around the visible area
+    GST_DEBUG_OBJECT (dec, "cropping not supported by downstream");
     goto fallback;
   }
 
-  struct GstLibde265FrameRef *ref =
-      (struct GstLibde265FrameRef *) g_malloc0 (sizeof (*ref));
-  g_assert (ref != NULL);
+allocate:
+  if (!exported) {
+    ret = ALLOC_OUTPUT_FRAME (GST_VIDEO_DECODER (dec), frame);
+    if (G_UNLIKELY (ret != GST_FLOW_OK)) {
+      GST_ERROR_OBJECT (dec, "Failed to allocate output buffer");
+      goto fallback;
+    }
+  }
+
+  struct GstLibde265FrameRef *ref = _gst_libde265_dec_take_frame_ref (dec);
   ref->decoder = base;
   ref->frame = frame;
 
-  gst_buffer_replace (&ref->buffer, frame->output_buffer);
-  gst_buffer_replace (&frame->output_buffer, NULL);
+  if (exported) {
+    ref->buffer = _gst_libde265_dec_alloc_exported (dec, spec, format);
+    if (ref->buffer == NULL) {
+      GST_ERROR_OBJECT (dec, "Failed to allocate exported buffer");
+      goto release;
+    }
+  } else {
+    gst_buffer_replace (&ref->buffer, frame->output_buffer);
+    gst_buffer_replace (&frame->output_buffer, NULL);
+  }
+
+  // with padding, the video meta of the pool already describes the
+  // visible area
+  if (crop && !exported && dec->use_crop_meta) {
+    _gst_libde265_dec_set_crop (ref->buffer, spec->crop_left, spec->crop_top,
+        spec->visible_width, spec->visible_height);
+  }
 
   GstVideoInfo *info = &dec->output_state->info;
   if (!gst_video_frame_map (&ref->vframe, info, ref->buffer, GST_MAP_READWRITE)) {
@@ -512,9 +1533,12 @@ gst_libde265_dec_get_buffer (de265_decoder_context * ctx,
     goto error;
   }
 
-  if (GST_VIDEO_FRAME_COMP_HEIGHT (&ref->vframe, 0) < height) {
+  // with padding, the frame only describes the visible lines
+  gboolean padded = dec->use_padding || exported;
+  int lines = padded ? spec->visible_height : height;
+  if (GST_VIDEO_FRAME_COMP_HEIGHT (&ref->vframe, 0) < lines) {
     GST_DEBUG_OBJECT (dec, "plane 0: lines too few (%d/%d)",
-        GST_VIDEO_FRAME_COMP_HEIGHT (&ref->vframe, 0), height);
+        GST_VIDEO_FRAME_COMP_HEIGHT (&ref->vframe, 0), lines);
     goto error;
   }
 
@@ -527,6 +1551,14 @@ gst_libde265_dec_get_buffer (de265_decoder_context * ctx,
     }
 
     uint8_t *data = GST_VIDEO_FRAME_PLANE_DATA (&ref->vframe, i);
+    if (padded) {
+      // move from the visible area to the start of the coded picture
+      const GstVideoFormatInfo *finfo = ref->vframe.info.finfo;
+      data -= GST_VIDEO_SUB_SCALE (GST_VIDEO_FORMAT_INFO_H_SUB (finfo, i),
+          spec->crop_top) * stride;
+      data -= GST_VIDEO_SUB_SCALE (GST_VIDEO_FORMAT_INFO_W_SUB (finfo, i),
+          spec->crop_left) * GST_VIDEO_FRAME_COMP_PSTRIDE (&ref->vframe, i);
+    }
     if ((uintptr_t) (data) % spec->alignment) {
       GST_DEBUG_OBJECT (dec, "plane %d not aligned", i);
       goto error;
@@ -534,12 +1566,46 @@ gst_libde265_dec_get_buffer (de265_decoder_context * ctx,
 
     de265_set_image_plane (img, i, data, stride, ref);
   }
+  dec->direct_frames++;
+  if (exported) {
+    dec->exported_frames++;
+  }
   return 1;
 
 error:
+  if (!exported && dec->use_video_meta) {
+    // the layout of the buffers of downstream doesn't fit, use own
+    // buffers until the allocation is renegotiated
+    GST_DEBUG_OBJECT (dec, "Exporting own buffers instead");
+    dec->export_frames = TRUE;
+    exported = TRUE;
+    gst_video_codec_frame_ref (frame);
+    gst_libde265_dec_release_frame_ref (ref);
+    goto allocate;
+  }
+
+release:
+  // also drops the reference to the codec frame
   gst_libde265_dec_release_frame_ref (ref);
+  frame = NULL;
 
 fallback:
+  if (frame != NULL) {
+    gst_video_codec_frame_unref (frame);
+  }
+  dec->fallback_frames++;
+  GST_DEBUG_OBJECT (dec, "Direct rendering not possible, %u of %u frames "
+      "copied so far", dec->fallback_frames,
+      dec->fallback_frames + dec->direct_frames);
+
+decode_only:
+#ifdef HAVE_HUGEPAGE_OUTPUT
+  if (dec->huge_pages
+      && dec->output_memory == GST_TYPE_LIBDE265_DEC_MEMORY_SYSTEM
+      && _gst_libde265_dec_alloc_hugepage_picture (dec, spec, img)) {
+    return 1;
+  }
+#endif
   return de265_get_default_image_allocation_functions ()->get_buffer (ctx,
       spec, img, userdata);
 }
@@ -561,50 +1627,196 @@ gst_libde265_dec_release_buffer (de265_decoder_context * ctx,
 }
 #endif
 
+static inline gboolean
+_gst_libde265_dec_threads_from_stream (GstLibde265Dec * dec)
+{
+  return dec->max_threads == 0
+      && dec->threads_policy == GST_TYPE_LIBDE265_DEC_THREADS_RESOLUTION;
+}
+
+// the GOP workers decode, the context only receives the parameter sets
+static inline gboolean
+_gst_libde265_dec_gop_active (GstLibde265Dec * dec)
+{
+#if GST_CHECK_VERSION(1,0,0)
+  return dec->gop_worker_count > 0;
+#else
+  return FALSE;
+#endif
+}
+
+static int
+_gst_libde265_dec_wanted_threads (GstLibde265Dec * dec)
+{
+  if (dec->max_threads > 0) {
+    return dec->max_threads;
+  }
+  if (_gst_libde265_dec_threads_from_stream (dec) && dec->have_sps) {
+    int tiles = 1;
+    gboolean wpp = FALSE;
+    if (dec->have_pps) {
+      tiles = dec->pps.num_tile_columns * dec->pps.num_tile_rows;
+      wpp = dec->pps.entropy_coding_sync_enabled;
+    }
+    return gst_libde265_threads_for_stream (dec->sps.width, dec->sps.height,
+        dec->sps.ctb_size, tiles, wpp);
+  }
+  return gst_libde265_threads_auto_count ();
+}
+
+// join the thread budget and return the share of it
+static int
+_gst_libde265_dec_join_budget (GstLibde265Dec * dec, int wanted)
+{
+  gst_libde265_threads_join (dec, dec->thread_budget, wanted);
+  if (gst_libde265_threads_limited_by_pool (dec)) {
+    // idle contexts give way to decoders that are running
+    GST_DEBUG_OBJECT (dec, "Freeing idle contexts for the thread budget");
+    gst_libde265_pool_clear ();
+  }
+  return gst_libde265_threads_assign (dec);
+}
+
+// number of worker threads to start, 0 if decoding is single-threaded
+static int
+_gst_libde265_dec_assign_threads (GstLibde265Dec * dec)
+{
+  int threads;
+
+  if (_gst_libde265_dec_gop_active (dec)) {
+    // the share of the budget is held by the GOP workers
+    dec->threads_wanted = 0;
+    return 0;
+  }
+  threads = dec->threads_wanted = _gst_libde265_dec_wanted_threads (dec);
+  if (dec->thread_budget > 0) {
+    threads = _gst_libde265_dec_join_budget (dec, threads);
+  }
+  if (threads <= 1) {
+    return 0;
+  }
+  // TODO: this limit should come from the libde265 headers
+  return MIN (threads, 32);
+}
+
+static void
+_gst_libde265_dec_set_threads (GstLibde265Dec * dec, int threads)
+{
+  dec->ctx_threads = threads;
+  GST_INFO_OBJECT (dec, "Using libde265 %s with %d worker threads",
+      de265_get_version (), threads);
+  if (threads != dec->threads) {
+    dec->threads = threads;
+    g_object_notify (G_OBJECT (dec), "threads");
+  }
+}
+
+static void
+_gst_libde265_dec_start_threads (GstLibde265Dec * dec)
+{
+  int threads = _gst_libde265_dec_assign_threads (dec);
+
+  dec->threads_pending = FALSE;
+  if (threads > 0) {
+    de265_start_worker_threads (dec->ctx, threads);
+  }
+  _gst_libde265_dec_set_threads (dec, threads);
+}
+
+/*
+ * Borrow a context from the process-wide pool. Until the first SPS has
+ * been seen any context will do, its worker threads are resized at the
+ * next IRAP picture like for changed stream parameters if necessary.
+ */
 static gboolean
-gst_libde265_dec_start (VIDEO_DECODER_BASE * parse)
+_gst_libde265_dec_acquire_context (GstLibde265Dec * dec, gboolean pending)
 {
-  GstLibde265Dec *dec = GST_LIBDE265_DEC (parse);
-  int threads = dec->max_threads;
+  int threads = GST_LIBDE265_POOL_ANY_THREADS;
+  int held;
 
-  _gst_libde265_dec_free_decoder (dec);
-  dec->ctx = de265_new_decoder ();
+  if (pending && dec->thread_budget > 0) {
+    // the share of the budget isn't known yet
+    return FALSE;
+  }
+  if (!pending) {
+    threads = _gst_libde265_dec_assign_threads (dec);
+  }
+  dec->ctx = gst_libde265_pool_acquire (threads, &held);
   if (dec->ctx == NULL) {
     return FALSE;
   }
+  if (threads != GST_LIBDE265_POOL_ANY_THREADS) {
+    // decoders with this thread count come and go, keep a context ready
+    // for the next one that starts
+    gst_libde265_pool_prestart (threads, dec->context_pool);
+  }
 
-  if (threads == 0) {
-#if defined(_SC_NPROC_ONLN)
-    threads = sysconf (_SC_NPROC_ONLN);
-#elif defined(_SC_NPROCESSORS_ONLN)
-    threads = sysconf (_SC_NPROCESSORS_ONLN);
-#else
-#warning "Don't know how to get number of CPU cores, will use the default thread count"
-    threads = DEFAULT_THREAD_COUNT;
+  GST_DEBUG_OBJECT (dec, "Using pooled context");
+  dec->pooled_contexts++;
+  if (pending) {
+    dec->threads_wanted = held;
+  }
+  _gst_libde265_dec_set_threads (dec, held);
+  return TRUE;
+}
+
+/*
+ * Return the context to the pool if it is enabled, free it otherwise.
+ */
+static void
+_gst_libde265_dec_release_context (GstLibde265Dec * dec)
+{
+  if (dec->ctx == NULL) {
+    return;
+  }
+
+  if (dec->context_pool > 0) {
+    // releases the pictures still held by the context to this decoder
+    de265_reset (dec->ctx);
+#if GST_CHECK_VERSION(1,0,0)
+    struct de265_image_allocation allocation =
+        *de265_get_default_image_allocation_functions ();
+    de265_set_image_allocation_functions (dec->ctx, &allocation, NULL);
 #endif
-    if (threads <= 0) {
-      threads = DEFAULT_THREAD_COUNT;
-    }
-    // XXX: We start more threads than cores for now, as some threads
-    // might get blocked while waiting for dependent data. Having more
-    // threads increases decoding speed by about 10%
-    threads *= 2;
+    de265_set_limit_TID (dec->ctx, GST_LIBDE265_MAX_SUB_LAYERS - 1);
+    gst_libde265_pool_release (dec->ctx, dec->ctx_threads,
+        dec->context_pool);
+  } else {
+    de265_free_decoder (dec->ctx);
   }
-  if (threads > 1) {
-    if (threads > 32) {
-      // TODO: this limit should come from the libde265 headers
-      threads = 32;
+  dec->ctx = NULL;
+}
+
+static gboolean
+_gst_libde265_dec_create_context (GstLibde265Dec * dec)
+{
+  gboolean pending = _gst_libde265_dec_threads_from_stream (dec)
+      && !dec->have_sps && !_gst_libde265_dec_gop_active (dec);
+
+  dec->threads_resize = FALSE;
+  dec->threads_pending = FALSE;
+  if (dec->context_pool <= 0
+      || !_gst_libde265_dec_acquire_context (dec, pending)) {
+    dec->ctx = de265_new_decoder ();
+    if (dec->ctx == NULL) {
+      return FALSE;
+    }
+    if (pending) {
+      // size the worker pool once the first SPS has been seen
+      dec->threads_pending = TRUE;
+    } else {
+      _gst_libde265_dec_start_threads (dec);
     }
-    de265_start_worker_threads (dec->ctx, threads);
   }
-  GST_INFO ("Using libde265 %s with %d worker threads", de265_get_version (),
-      threads);
 
+  // a new context decodes all sub-layers
+  dec->highest_tid = GST_LIBDE265_MAX_SUB_LAYERS - 1;
+  _gst_libde265_dec_update_tid (dec, -1, 0);
 #if GST_CHECK_VERSION(1,0,0)
   struct de265_image_allocation allocation;
   allocation.get_buffer = gst_libde265_dec_get_buffer;
   allocation.release_buffer = gst_libde265_dec_release_buffer;
-  de265_set_image_allocation_functions (dec->ctx, &allocation, parse);
+  de265_set_image_allocation_functions (dec->ctx, &allocation, dec);
 #endif
   // NOTE: we explicitly disable hash checks for now
   de265_set_parameter_bool (dec->ctx, DE265_DECODER_PARAM_BOOL_SEI_CHECK_HASH,
@@ -612,79 +1824,280 @@ gst_libde265_dec_start (VIDEO_DECODER_BASE * parse)
   return TRUE;
 }
 
-static gboolean
-gst_libde265_dec_stop (VIDEO_DECODER_BASE * parse)
+#if GST_CHECK_VERSION(1,0,0)
+/*
+ * Asynchronous decoding: handle_frame only queues the input frames and a
+ * separate thread passes them to libde265 and finishes the decoded frames,
+ * so upstream can continue while a frame is decoded. The decoder context
+ * is only used by that thread while it is running, everything else that
+ * needs the context waits until the thread is idle.
+ */
+static gpointer
+_gst_libde265_dec_async_loop (gpointer data)
 {
-  GstLibde265Dec *dec = GST_LIBDE265_DEC (parse);
+  GstLibde265Dec *dec = GST_LIBDE265_DEC (data);
 
-  _gst_libde265_dec_free_decoder (dec);
+  g_mutex_lock (&dec->async_lock);
+  while (TRUE) {
+    while (dec->async_count == 0 && !dec->async_quit) {
+      g_cond_wait (&dec->async_cond, &dec->async_lock);
+    }
+    if (dec->async_quit) {
+      break;
+    }
 
-  return TRUE;
-}
+    VIDEO_FRAME *frame = dec->async_queue[dec->async_head];
+    dec->async_head = (dec->async_head + 1) % dec->async_size;
+    dec->async_count--;
+    dec->async_busy = TRUE;
+    g_cond_broadcast (&dec->async_cond);
+    g_mutex_unlock (&dec->async_lock);
 
-#if GST_CHECK_VERSION(1,2,0)
-static gboolean
-gst_libde265_dec_flush (VIDEO_DECODER_BASE * parse)
-#elif GST_CHECK_VERSION(1,0,0)
-static gboolean
-gst_libde265_dec_reset (VIDEO_DECODER_BASE * parse, gboolean hard)
-#else
-static gboolean
-gst_libde265_dec_reset (VIDEO_DECODER_BASE * parse)
-#endif
-{
-  GstLibde265Dec *dec = GST_LIBDE265_DEC (parse);
+    GstFlowReturn ret =
+        _gst_libde265_dec_process_frame (GST_VIDEO_DECODER (dec), frame);
 
-  de265_reset (dec->ctx);
-  dec->buffer_full = 0;
-  if (dec->codec_data != NULL && dec->mode == GST_TYPE_LIBDE265_DEC_RAW) {
-    int more;
-    de265_error err =
-        de265_push_data (dec->ctx, dec->codec_data, dec->codec_data_size, 0,
-        NULL);
-    if (!de265_isOK (err)) {
-      GST_ELEMENT_ERROR (parse, STREAM, DECODE,
-          ("Failed to push codec data: %s (code=%d)",
-              de265_get_error_text (err), err), (NULL));
-      return FALSE;
+    g_mutex_lock (&dec->async_lock);
+    dec->async_busy = FALSE;
+    if (ret != GST_FLOW_OK && dec->async_flow == GST_FLOW_OK) {
+      // reported upstream from the next handle_frame
+      GST_DEBUG_OBJECT (dec, "Decoding thread got %s",
+          gst_flow_get_name (ret));
+      dec->async_flow = ret;
     }
-    de265_push_end_of_NAL (dec->ctx);
-    do {
-      err = de265_decode (dec->ctx, &more);
-      switch (err) {
-        case DE265_OK:
-          break;
+    g_cond_broadcast (&dec->async_cond);
+  }
+  g_mutex_unlock (&dec->async_lock);
+  return NULL;
+}
 
-        case DE265_ERROR_IMAGE_BUFFER_FULL:
-        case DE265_ERROR_WAITING_FOR_INPUT_DATA:
-          // not really an error
-          more = 0;
-          break;
+// must be called with the stream lock held
+static GstFlowReturn
+_gst_libde265_dec_async_push (GstLibde265Dec * dec, VIDEO_FRAME * frame)
+{
+  GstFlowReturn ret;
 
-        default:
-          if (!de265_isOK (err)) {
-            GST_ELEMENT_ERROR (parse, STREAM, DECODE,
-                ("Failed to decode codec data: %s (code=%d)",
-                    de265_get_error_text (err), err), (NULL));
-            return FALSE;
-          }
-      }
-    } while (more);
+  // the decoding thread needs the stream lock to finish frames
+  GST_VIDEO_DECODER_STREAM_UNLOCK (dec);
+  g_mutex_lock (&dec->async_lock);
+  while (dec->async_count == dec->async_size
+      && dec->async_flow == GST_FLOW_OK) {
+    g_cond_wait (&dec->async_cond, &dec->async_lock);
+  }
+  ret = dec->async_flow;
+  if (ret == GST_FLOW_OK) {
+    int tail = (dec->async_head + dec->async_count) % dec->async_size;
+    dec->async_queue[tail] = frame;
+    dec->async_count++;
+    g_cond_broadcast (&dec->async_cond);
   }
+  g_mutex_unlock (&dec->async_lock);
+  GST_VIDEO_DECODER_STREAM_LOCK (dec);
 
-  return TRUE;
+  if (ret != GST_FLOW_OK) {
+    gst_video_codec_frame_unref (frame);
+  }
+  return ret;
 }
 
-static GstFlowReturn
-_gst_libde265_image_available (VIDEO_DECODER_BASE * parse,
-    int width, int height, GstVideoFormat format)
+// discard queued frames (or not) and wait until the decoding thread is
+// idle, must be called with the stream lock held
+static void
+_gst_libde265_dec_async_wait (GstLibde265Dec * dec, gboolean discard)
 {
-  GstLibde265Dec *dec = GST_LIBDE265_DEC (parse);
+  if (dec->async_thread == NULL) {
+    return;
+  }
 
-  if (G_UNLIKELY (width != dec->width || height != dec->height)) {
-#if GST_CHECK_VERSION(1,0,0)
-    GstVideoCodecState *state =
-        gst_video_decoder_set_output_state (parse, format, width,
+  GST_VIDEO_DECODER_STREAM_UNLOCK (dec);
+  g_mutex_lock (&dec->async_lock);
+  while (discard && dec->async_count > 0) {
+    gst_video_codec_frame_unref (dec->async_queue[dec->async_head]);
+    dec->async_head = (dec->async_head + 1) % dec->async_size;
+    dec->async_count--;
+  }
+  // wake up a handle_frame waiting for space in the queue
+  g_cond_broadcast (&dec->async_cond);
+  while (dec->async_count > 0 || dec->async_busy) {
+    g_cond_wait (&dec->async_cond, &dec->async_lock);
+  }
+  g_mutex_unlock (&dec->async_lock);
+  GST_VIDEO_DECODER_STREAM_LOCK (dec);
+}
+
+static void
+_gst_libde265_dec_async_start (GstLibde265Dec * dec)
+{
+  dec->async_size = dec->async_depth;
+  dec->async_queue = g_new0 (VIDEO_FRAME *, dec->async_size);
+  dec->async_head = 0;
+  dec->async_count = 0;
+  dec->async_busy = FALSE;
+  dec->async_quit = FALSE;
+  dec->async_flow = GST_FLOW_OK;
+  dec->async_thread =
+      g_thread_new ("libde265dec", _gst_libde265_dec_async_loop, dec);
+}
+
+static void
+_gst_libde265_dec_async_stop (GstLibde265Dec * dec)
+{
+  if (dec->async_thread == NULL) {
+    return;
+  }
+
+  g_mutex_lock (&dec->async_lock);
+  dec->async_quit = TRUE;
+  g_cond_broadcast (&dec->async_cond);
+  g_mutex_unlock (&dec->async_lock);
+  g_thread_join (dec->async_thread);
+  dec->async_thread = NULL;
+
+  while (dec->async_count > 0) {
+    gst_video_codec_frame_unref (dec->async_queue[dec->async_head]);
+    dec->async_head = (dec->async_head + 1) % dec->async_size;
+    dec->async_count--;
+  }
+  g_free (dec->async_queue);
+  dec->async_queue = NULL;
+}
+#endif
+
+static gboolean
+gst_libde265_dec_start (VIDEO_DECODER_BASE * parse)
+{
+  GstLibde265Dec *dec = GST_LIBDE265_DEC (parse);
+
+  _gst_libde265_dec_free_decoder (dec);
+  if (!_gst_libde265_dec_create_context (dec)) {
+    return FALSE;
+  }
+#if GST_CHECK_VERSION(1,0,0)
+  if (dec->async_depth > 0) {
+    _gst_libde265_dec_async_start (dec);
+  }
+#endif
+  return TRUE;
+}
+
+static gboolean
+gst_libde265_dec_stop (VIDEO_DECODER_BASE * parse)
+{
+  GstLibde265Dec *dec = GST_LIBDE265_DEC (parse);
+
+#if GST_CHECK_VERSION(1,0,0)
+  if (dec->fallback_frames > 0) {
+    GST_INFO_OBJECT (dec, "%u of %u frames were copied instead of direct "
+        "rendered, %u for semi-planar output", dec->fallback_frames,
+        dec->fallback_frames + dec->direct_frames, dec->semi_planar_frames);
+  }
+  _gst_libde265_dec_async_stop (dec);
+  _gst_libde265_dec_gop_stop (dec);
+#endif
+  _gst_libde265_dec_release_context (dec);
+  _gst_libde265_dec_free_decoder (dec);
+  gst_libde265_threads_leave (dec);
+
+  return TRUE;
+}
+
+#if GST_CHECK_VERSION(1,2,0)
+static gboolean
+gst_libde265_dec_flush (VIDEO_DECODER_BASE * parse)
+#elif GST_CHECK_VERSION(1,0,0)
+static gboolean
+gst_libde265_dec_reset (VIDEO_DECODER_BASE * parse, gboolean hard)
+#else
+static gboolean
+gst_libde265_dec_reset (VIDEO_DECODER_BASE * parse)
+#endif
+{
+  GstLibde265Dec *dec = GST_LIBDE265_DEC (parse);
+
+#if GST_CHECK_VERSION(1,0,0)
+  _gst_libde265_dec_async_wait (dec, TRUE);
+  dec->async_flow = GST_FLOW_OK;
+  _gst_libde265_dec_gop_discard (dec);
+  // downstream may prefer a different layout after seeking
+  dec->planar_format = GST_VIDEO_FORMAT_UNKNOWN;
+  // the base class has discarded the data of the current access unit
+  dec->parse_have_vcl = FALSE;
+#endif
+  dec->buffer_full = 0;
+  dec->raw_skipping = FALSE;
+  // the RASL pictures of the IRAP picture decoding restarts at reference
+  // pictures that are not available
+  dec->no_rasl_output = TRUE;
+  dec->skip_rasl = FALSE;
+  dec->qos_level = 0;
+  dec->qos_late = 0;
+  dec->qos_on_time = 0;
+  if (_gst_libde265_dec_context_outdated (dec)) {
+    // libde265 can't resize the worker pool, use a new context instead
+    GST_DEBUG_OBJECT (dec, "Resizing worker threads");
+    _gst_libde265_dec_release_context (dec);
+    if (!_gst_libde265_dec_create_context (dec)) {
+      GST_ELEMENT_ERROR (dec, LIBRARY, INIT,
+          ("Failed to create decoder context"), (NULL));
+      return FALSE;
+    }
+    return _gst_libde265_dec_restore_param_sets (dec);
+  }
+
+  de265_reset (dec->ctx);
+  // decoding restarts at an IRAP picture
+  _gst_libde265_dec_update_tid (dec, -1, 0);
+  return _gst_libde265_dec_restore_param_sets (dec);
+}
+
+static GstFlowReturn
+_gst_libde265_image_available (VIDEO_DECODER_BASE * parse,
+    int width, int height, const struct de265_image_spec *spec,
+    GstVideoFormat format)
+{
+  GstLibde265Dec *dec = GST_LIBDE265_DEC (parse);
+  int coded_width = width;
+  int coded_height = height;
+  int crop_left = 0;
+  int crop_top = 0;
+  int alignment = dec->alignment;
+  int rate_divider = _gst_libde265_dec_rate_divider (dec);
+#if GST_CHECK_VERSION(1,0,0)
+  gboolean format_changed = dec->output_state == NULL
+      || GST_VIDEO_INFO_FORMAT (&dec->output_state->info) != format;
+#else
+  gboolean format_changed = FALSE;
+#endif
+
+  if (spec != NULL) {
+    coded_width = spec->width;
+    coded_height = spec->height;
+    crop_left = spec->crop_left;
+    crop_top = spec->crop_top;
+    alignment = spec->alignment;
+  } else if (width == dec->width && height == dec->height) {
+    // caller doesn't know the coded layout, keep the current one
+    coded_width = dec->coded_width;
+    coded_height = dec->coded_height;
+    crop_left = dec->crop_left;
+    crop_top = dec->crop_top;
+  }
+
+  if (G_UNLIKELY (width != dec->width || height != dec->height
+          || coded_width != dec->coded_width
+          || coded_height != dec->coded_height
+          || crop_left != dec->crop_left || crop_top != dec->crop_top
+          || alignment != dec->alignment
+          || rate_divider != dec->rate_divider || format_changed)) {
+    // needed by decide_allocation during negotiation
+    dec->coded_width = coded_width;
+    dec->coded_height = coded_height;
+    dec->crop_left = crop_left;
+    dec->crop_top = crop_top;
+    dec->alignment = alignment;
+    dec->rate_divider = rate_divider;
+#if GST_CHECK_VERSION(1,0,0)
+    GstVideoCodecState *state =
+        gst_video_decoder_set_output_state (parse, format, width,
         height, dec->input_state);
     g_assert (state != NULL);
     if (dec->fps_n > 0) {
@@ -698,11 +2111,16 @@ _gst_libde265_image_available (VIDEO_DECODER_BASE * parse,
       state->info.fps_n = 24;
       state->info.fps_d = 1;
     }
+    if (rate_divider > 1) {
+      gst_util_fraction_multiply (state->info.fps_n, state->info.fps_d, 1,
+          rate_divider, &state->info.fps_n, &state->info.fps_d);
+    }
     gst_video_decoder_negotiate (parse);
     if (dec->output_state != NULL) {
       gst_video_codec_state_unref (dec->output_state);
     }
     dec->output_state = state;
+    _gst_libde265_dec_update_latency (dec);
 #else
     GstVideoState *state = gst_base_video_decoder_get_state (parse);
     g_assert (state != NULL);
@@ -720,9 +2138,14 @@ _gst_libde265_image_available (VIDEO_DECODER_BASE * parse,
       state->fps_n = 24;
       state->fps_d = 1;
     }
+    if (rate_divider > 1) {
+      gst_util_fraction_multiply (state->fps_n, state->fps_d, 1,
+          rate_divider, &state->fps_n, &state->fps_d);
+    }
     gst_base_video_decoder_set_src_caps (parse);
 #endif
-    GST_DEBUG ("Frame dimensions are %d x %d", width, height);
+    GST_DEBUG ("Frame dimensions are %d x %d (coded %d x %d)", width, height,
+        coded_width, coded_height);
     dec->width = width;
     dec->height = height;
   }
@@ -730,436 +2153,2580 @@ _gst_libde265_image_available (VIDEO_DECODER_BASE * parse,
   return GST_FLOW_OK;
 }
 
+#if GST_CHECK_VERSION(1,0,0)
 static gboolean
-gst_libde265_dec_set_format (VIDEO_DECODER_BASE * parse, VIDEO_STATE * state)
+_gst_libde265_dec_configure_pool (GstBufferPool * pool, GstCaps * caps,
+    guint size, guint min, guint max, GstAllocator * allocator,
+    GstAllocationParams * params, GstVideoAlignment * align)
+{
+  GstStructure *config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps, size, min, max);
+  gst_buffer_pool_config_set_allocator (config, allocator, params);
+  gst_buffer_pool_config_add_option (config, GST_BUFFER_POOL_OPTION_VIDEO_META);
+  gst_buffer_pool_config_add_option (config,
+      GST_BUFFER_POOL_OPTION_VIDEO_ALIGNMENT);
+  gst_buffer_pool_config_set_video_alignment (config, align);
+  return gst_buffer_pool_set_config (pool, config);
+}
+
+static gboolean
+gst_libde265_dec_decide_allocation (VIDEO_DECODER_BASE * parse,
+    GstQuery * query)
 {
   GstLibde265Dec *dec = GST_LIBDE265_DEC (parse);
+  GstBufferPool *pool;
+  GstStructure *config;
+  GstAllocator *allocator = NULL;
+  GstAllocationParams params;
+  GstVideoAlignment align;
+  GstVideoInfo info;
+  GstCaps *caps;
+  guint size, min, max;
+  int i;
 
-#if GST_CHECK_VERSION(1,0,0)
-  if (dec->input_state != NULL) {
-    gst_video_codec_state_unref (dec->input_state);
-  }
-  dec->input_state = state;
-  if (state != NULL) {
-    gst_video_codec_state_ref (state);
+  if (!GST_VIDEO_DECODER_CLASS (parent_class)->decide_allocation (parse,
+          query)) {
+    return FALSE;
   }
-#endif
-  if (state != NULL && state->caps != NULL) {
-    GstStructure *str;
-    const GValue *value;
-    str = gst_caps_get_structure (state->caps, 0);
-    if ((value = gst_structure_get_value (str, "codec_data"))) {
-#if GST_CHECK_VERSION(1,0,0)
-      GstMapInfo info;
-#endif
-      guint8 *data;
-      gsize size;
-      GstBuffer *buf;
-      de265_error err;
-      int more;
 
-      buf = gst_value_get_buffer (value);
-#if GST_CHECK_VERSION(1,0,0)
-      if (!gst_buffer_map (buf, &info, GST_MAP_READ)) {
-        GST_ELEMENT_ERROR (parse, STREAM, DECODE,
-            ("Failed to map codec data"), (NULL));
-        return FALSE;
-      }
-      data = info.data;
-      size = info.size;
-#else
-      data = GST_BUFFER_DATA (buf);
-      size = GST_BUFFER_SIZE (buf);
-#endif
-      free (dec->codec_data);
-      dec->codec_data = malloc (size);
-      g_assert (dec->codec_data != NULL);
-      dec->codec_data_size = size;
-      memcpy (dec->codec_data, data, size);
-      if (size > 3 && (data[0] || data[1] || data[2] > 1)) {
-        // encoded in "hvcC" format (assume version 0)
-        dec->mode = GST_TYPE_LIBDE265_DEC_PACKETIZED;
-        if (size > 22) {
-          int i;
-          if (data[0] != 0) {
-            GST_ELEMENT_WARNING (parse, STREAM,
-                DECODE, ("Unsupported extra data version %d, decoding may fail",
-                    data[0]), (NULL));
-          }
-          dec->length_size = (data[21] & 3) + 1;
-          int num_param_sets = data[22];
-          int pos = 23;
-          for (i = 0; i < num_param_sets; i++) {
-            int j;
-            if (pos + 3 > size) {
-              GST_ELEMENT_ERROR (parse, STREAM, DECODE,
-                  ("Buffer underrun in extra header (%d >= %ld)", pos + 3,
-                      size), (NULL));
-              return FALSE;
-            }
-            // ignore flags + NAL type (1 byte)
-            int nal_count = data[pos + 1] << 8 | data[pos + 2];
-            pos += 3;
-            for (j = 0; j < nal_count; j++) {
-              if (pos + 2 > size) {
-                GST_ELEMENT_ERROR (parse, STREAM, DECODE,
-                    ("Buffer underrun in extra nal header (%d >= %ld)", pos + 2,
-                        size), (NULL));
-                return FALSE;
-              }
-              int nal_size = data[pos] << 8 | data[pos + 1];
-              if (pos + 2 + nal_size > size) {
-                GST_ELEMENT_ERROR (parse, STREAM, DECODE,
-                    ("Buffer underrun in extra nal (%d >= %ld)",
-                        pos + 2 + nal_size, size), (NULL));
-                return FALSE;
-              }
-              err =
-                  de265_push_NAL (dec->ctx, data + pos + 2, nal_size, 0, NULL);
-              if (!de265_isOK (err)) {
-                GST_ELEMENT_ERROR (parse, STREAM, DECODE,
-                    ("Failed to push data: %s (%d)", de265_get_error_text (err),
-                        err), (NULL));
-                return FALSE;
-              }
-              pos += 2 + nal_size;
-            }
-          }
-        }
-        GST_DEBUG ("Assuming packetized data (%d bytes length)",
-            dec->length_size);
-      } else {
-        dec->mode = GST_TYPE_LIBDE265_DEC_RAW;
-        GST_DEBUG ("Assuming non-packetized data");
-        err = de265_push_data (dec->ctx, data, size, 0, NULL);
-        if (!de265_isOK (err)) {
-#if GST_CHECK_VERSION(1,0,0)
-          gst_buffer_unmap (buf, &info);
-#endif
-          GST_ELEMENT_ERROR (parse, STREAM, DECODE,
-              ("Failed to push codec data: %s (code=%d)",
-                  de265_get_error_text (err), err), (NULL));
-          return FALSE;
-        }
-      }
-#if GST_CHECK_VERSION(1,0,0)
-      gst_buffer_unmap (buf, &info);
-#endif
-      de265_push_end_of_NAL (dec->ctx);
-      do {
-        err = de265_decode (dec->ctx, &more);
-        switch (err) {
-          case DE265_OK:
-            break;
-
-          case DE265_ERROR_IMAGE_BUFFER_FULL:
-          case DE265_ERROR_WAITING_FOR_INPUT_DATA:
-            // not really an error
-            more = 0;
-            break;
-
-          default:
-            if (!de265_isOK (err)) {
-              GST_ELEMENT_ERROR (parse, STREAM, DECODE,
-                  ("Failed to decode codec data: %s (code=%d)",
-                      de265_get_error_text (err), err), (NULL));
-              return FALSE;
-            }
-        }
-      } while (more);
-    } else if ((value = gst_structure_get_value (str, "stream-format"))) {
-      const gchar *str = g_value_get_string (value);
-      if (strcmp (str, "byte-stream") == 0) {
-        dec->mode = GST_TYPE_LIBDE265_DEC_RAW;
-        GST_DEBUG ("Assuming raw byte-stream");
-      }
-    }
+  dec->use_crop_meta = FALSE;
+  dec->use_padding = FALSE;
+  dec->use_video_meta = FALSE;
+  dec->export_frames = FALSE;
+  gst_query_parse_allocation (query, &caps, NULL);
+  if (caps == NULL || !gst_video_info_from_caps (&info, caps)) {
+    return TRUE;
   }
 
-  return TRUE;
-}
-
-static GstFlowReturn
-gst_libde265_dec_handle_frame (VIDEO_DECODER_BASE * parse, VIDEO_FRAME * frame)
-{
-  GstLibde265Dec *dec = GST_LIBDE265_DEC (parse);
-  uint8_t *frame_data;
-  uint8_t *end_data;
-  const struct de265_image *img;
-  de265_error ret = DE265_OK;
-  int more = 0;
-  de265_PTS pts = (de265_PTS) FRAME_PTS (frame);
-  gsize size;
-
-#if GST_CHECK_VERSION(1,0,0)
-  GstMapInfo info;
-  if (!gst_buffer_map (frame->input_buffer, &info, GST_MAP_READ)) {
-    GST_ERROR_OBJECT (dec, "Failed to map input buffer");
-    return GST_FLOW_ERROR;
+  if (gst_query_get_n_allocation_params (query) > 0) {
+    gst_query_parse_nth_allocation_param (query, 0, &allocator, &params);
+  } else {
+    gst_allocation_params_init (&params);
+  }
+  GstAllocator *own_allocator = _gst_libde265_dec_own_allocator (dec);
+  if (own_allocator != NULL) {
+    gst_object_replace ((GstObject **) & allocator,
+        (GstObject *) own_allocator);
+  }
+  // libde265 needs the plane pointers aligned
+  params.align = MAX (params.align, (gsize) dec->alignment - 1);
+  if (gst_query_get_n_allocation_params (query) > 0) {
+    gst_query_set_nth_allocation_param (query, 0, allocator, &params);
+  } else {
+    gst_query_add_allocation_param (query, allocator, &params);
   }
 
-  frame_data = info.data;
-  size = info.size;
-#else
-  frame_data = GST_BUFFER_DATA (frame->sink_buffer);
-  size = GST_BUFFER_SIZE (frame->sink_buffer);
-#endif
-  end_data = frame_data + size;
+  gst_query_parse_nth_allocation_pool (query, 0, &pool, &size, &min, &max);
+  if (_gst_libde265_dec_gop_active (dec)) {
+    // the GOP workers take buffers for the pictures of several GOPs, a
+    // limited pool could keep the worker of the oldest GOP waiting
+    max = 0;
+  }
+  if (own_allocator != NULL) {
+    // the pool of downstream would use its own memory
+    GST_DEBUG_OBJECT (dec, "using own pool with %s memory",
+        own_allocator->mem_type);
+    gst_object_unref (pool);
+    pool = gst_video_buffer_pool_new ();
+  }
 
-#if GST_CHECK_VERSION(1,0,0)
-  GST_VIDEO_CODEC_FRAME_FLAG_SET (frame,
-      GST_VIDEO_CODEC_FRAME_FLAG_DECODE_ONLY);
-#endif
-  if (size > 0) {
-    if (dec->mode == GST_TYPE_LIBDE265_DEC_PACKETIZED) {
-      // stream contains length fields and NALs
-      uint8_t *start_data = frame_data;
-      while (start_data + dec->length_size <= end_data) {
-        int nal_size = 0;
-        int i;
-        for (i = 0; i < dec->length_size; i++) {
-          nal_size = (nal_size << 8) | start_data[i];
-        }
-        if (start_data + dec->length_size + nal_size > end_data) {
-          GST_ELEMENT_ERROR (parse, STREAM, DECODE,
-              ("Overflow in input data, check data mode"), (NULL));
-          goto error_input;
-        }
-        ret =
-            de265_push_NAL (dec->ctx, start_data + dec->length_size, nal_size,
-            pts, NULL);
-        if (ret != DE265_OK) {
-          GST_ELEMENT_ERROR (parse, STREAM, DECODE,
-              ("Error while pushing data: %s (code=%d)",
-                  de265_get_error_text (ret), ret), (NULL));
-          goto error_input;
-        }
-        start_data += dec->length_size + nal_size;
-      }
-    } else {
-      ret = de265_push_data (dec->ctx, frame_data, size, pts, NULL);
-      if (ret != DE265_OK) {
-        GST_ELEMENT_ERROR (parse, STREAM, DECODE,
-            ("Error while pushing data: %s (code=%d)",
-                de265_get_error_text (ret), ret), (NULL));
-        goto error_input;
+  if (!gst_query_find_allocation_meta (query, GST_VIDEO_META_API_TYPE, NULL)) {
+    // downstream expects the default layout, only the memory can be aligned
+    GST_DEBUG_OBJECT (dec, "downstream doesn't support video meta");
+    config = gst_buffer_pool_get_config (pool);
+    gst_buffer_pool_config_set_params (config, caps, size, min, max);
+    gst_buffer_pool_config_set_allocator (config, allocator, &params);
+    if (!gst_buffer_pool_set_config (pool, config)) {
+      GST_DEBUG_OBJECT (dec, "pool doesn't accept aligned allocations");
+      if (_gst_libde265_dec_gop_active (dec)) {
+        // the limit of the pool may have been kept
+        gst_object_unref (pool);
+        pool = gst_video_buffer_pool_new ();
+        config = gst_buffer_pool_get_config (pool);
+        gst_buffer_pool_config_set_params (config, caps, size, min, max);
+        gst_buffer_pool_config_set_allocator (config, allocator, &params);
+        gst_buffer_pool_set_config (pool, config);
       }
     }
-  } else {
-    ret = de265_flush_data (dec->ctx);
-    if (ret != DE265_OK) {
-      GST_ELEMENT_ERROR (parse, STREAM, DECODE,
-          ("Error while flushing data: %s (code=%d)",
-              de265_get_error_text (ret), ret), (NULL));
-      goto error_input;
-    }
+    gst_query_set_nth_allocation_pool (query, 0, pool, size, min, max);
+    goto done;
   }
-#if GST_CHECK_VERSION(1,0,0)
-  gst_buffer_unmap (frame->input_buffer, &info);
-#endif
+  dec->use_video_meta = TRUE;
 
-  // decode as much as possible
-#if GST_CHECK_VERSION(1,0,0)
-  dec->frame_number = frame->system_frame_number;
-#endif
-  do {
-    ret = de265_decode (dec->ctx, &more);
-  } while (more && ret == DE265_OK);
+  GstVideoInfo pool_info = info;
+  gst_video_alignment_reset (&align);
+  if (dec->coded_width != GST_VIDEO_INFO_WIDTH (&info)
+      || dec->coded_height != GST_VIDEO_INFO_HEIGHT (&info)) {
+    if (gst_query_find_allocation_meta (query, GST_VIDEO_CROP_META_API_TYPE,
+            NULL)) {
+      // Allocate the full coded picture, the visible area is described
+      // by a GstVideoCropMeta.
+      pool_info.width = dec->coded_width;
+      pool_info.height = dec->coded_height;
+      dec->use_crop_meta = TRUE;
+    } else {
+      // Frames keep the visible size, the remaining parts of the coded
+      // picture end up in the padding around it.
+      align.padding_left = dec->crop_left;
+      align.padding_top = dec->crop_top;
+      align.padding_right =
+          dec->coded_width - GST_VIDEO_INFO_WIDTH (&info) - dec->crop_left;
+      align.padding_bottom =
+          dec->coded_height - GST_VIDEO_INFO_HEIGHT (&info) - dec->crop_top;
+      dec->use_padding = TRUE;
+    }
+  }
+  for (i = 0; i < GST_VIDEO_MAX_PLANES; i++) {
+    align.stride_align[i] = dec->alignment - 1;
+  }
 
-  switch (ret) {
-    case DE265_OK:
-    case DE265_ERROR_WAITING_FOR_INPUT_DATA:
-      break;
+  GstCaps *pool_caps = gst_video_info_to_caps (&pool_info);
+  gst_video_info_align (&pool_info, &align);
+  size = MAX (size, GST_VIDEO_INFO_SIZE (&pool_info));
 
-    case DE265_ERROR_IMAGE_BUFFER_FULL:
-      dec->buffer_full = 1;
-      if ((img = de265_peek_next_picture (dec->ctx)) == NULL) {
-        return GST_FLOW_OK;
+  if (!gst_buffer_pool_has_option (pool, GST_BUFFER_POOL_OPTION_VIDEO_ALIGNMENT)
+      || !_gst_libde265_dec_configure_pool (pool, pool_caps, size, min, max,
+          allocator, &params, &align)) {
+    GST_DEBUG_OBJECT (dec, "using own pool with %d byte aligned frames",
+        dec->alignment);
+    gst_object_unref (pool);
+    pool = gst_video_buffer_pool_new ();
+    if (!_gst_libde265_dec_configure_pool (pool, pool_caps, size, min,
+            max, allocator, &params, &align)) {
+      GST_WARNING_OBJECT (dec, "failed to configure aligned pool");
+      gst_object_unref (pool);
+      gst_caps_unref (pool_caps);
+      dec->use_crop_meta = FALSE;
+      dec->use_padding = FALSE;
+      if (allocator != NULL) {
+        gst_object_unref (allocator);
       }
-      break;
+      return TRUE;
+    }
+  }
+  gst_caps_unref (pool_caps);
+  gst_query_set_nth_allocation_pool (query, 0, pool, size, min, max);
 
-    default:
-      GST_ELEMENT_ERROR (parse, STREAM, DECODE,
-          ("Error while decoding: %s (code=%d)", de265_get_error_text (ret),
-              ret), (NULL));
-      return GST_FLOW_ERROR;
+done:
+  gst_object_unref (pool);
+  if (allocator != NULL) {
+    gst_object_unref (allocator);
   }
+  return TRUE;
+}
+#endif
 
-  while ((ret = de265_get_warning (dec->ctx)) != DE265_OK) {
-    GST_ELEMENT_WARNING (parse, STREAM, DECODE,
-        ("%s (code=%d)", de265_get_error_text (ret), ret), (NULL));
+// number of temporal sub-layers in the stream, limited by the user
+static int
+_gst_libde265_dec_sub_layers (GstLibde265Dec * dec)
+{
+  int sub_layers = dec->have_sps ? dec->sps.max_sub_layers :
+      GST_LIBDE265_MAX_SUB_LAYERS;
+  if (dec->max_temporal_layer >= 0) {
+    sub_layers = MIN (sub_layers, dec->max_temporal_layer + 1);
   }
+  return sub_layers;
+}
 
-  img = de265_get_next_picture (dec->ctx);
-  if (img == NULL) {
-    // need more data
-    return GST_FLOW_OK;
+// highest temporal sub-layer that should be decoded
+static int
+_gst_libde265_dec_wanted_tid (GstLibde265Dec * dec)
+{
+  int highest = _gst_libde265_dec_sub_layers (dec) - 1;
+  // the first QoS level only skips sub-layer non-reference pictures,
+  // every further level skips one more temporal sub-layer
+  if (dec->qos_level > 1) {
+    highest = MAX (0, highest - (dec->qos_level - 1));
   }
-#if GST_CHECK_VERSION(1,0,0)
+  return highest;
+}
+
+/*
+ * Move the highest decoded temporal sub-layer towards the wanted one.
+ * Pictures of higher sub-layers may reference earlier pictures of their
+ * own sub-layer, so switching up has to wait for an IRAP picture or a
+ * sub-layer switching point if the NAL unit type is known (>= 0).
+ */
+static void
+_gst_libde265_dec_update_tid (GstLibde265Dec * dec, int type, int tid)
+{
+  int wanted = _gst_libde265_dec_wanted_tid (dec);
+  int highest = dec->highest_tid;
+
+  if (wanted < highest || type < 0 || GST_LIBDE265_NAL_IS_IRAP (type)) {
+    highest = wanted;
+  } else if (wanted > highest && GST_LIBDE265_NAL_IS_SWITCHING_POINT (type)
+      && tid == highest + 1) {
+    highest = tid;
+  }
+
+  if (highest != dec->highest_tid) {
+    GST_DEBUG_OBJECT (dec, "Decoding temporal sub-layers up to %d", highest);
+    dec->highest_tid = highest;
+    de265_set_limit_TID (dec->ctx, highest);
+  }
+}
+
+/*
+ * Factor by which the output frame rate is reduced by the sub-layers
+ * the user doesn't want to be decoded. Temporal scalability is assumed
+ * to be dyadic, i.e. every sub-layer doubles the frame rate.
+ */
+static int
+_gst_libde265_dec_rate_divider (GstLibde265Dec * dec)
+{
+  if (!dec->have_sps) {
+    return 1;
+  }
+  return 1 << (dec->sps.max_sub_layers - _gst_libde265_dec_sub_layers (dec));
+}
+
+// only IRAP pictures are decoded, they don't reference other pictures
+static inline gboolean
+_gst_libde265_dec_irap_only (GstLibde265Dec * dec)
+{
+  if (dec->skip_frames == GST_TYPE_LIBDE265_DEC_SKIP_NON_IRAP) {
+    return TRUE;
+  }
+#if GST_CHECK_VERSION(1,6,0)
+  if (GST_VIDEO_DECODER (dec)->input_segment.flags &
+      GST_SEGMENT_FLAG_TRICKMODE_KEY_UNITS) {
+    return TRUE;
+  }
+#endif
+  return FALSE;
+}
+
+/*
+ * Check if a slice NAL unit must not be passed to the decoder. Skipped
+ * pictures must not be referenced by any picture that is still decoded.
+ * Non-reference pictures are also skipped if their frame is clipped.
+ */
+static gboolean
+_gst_libde265_dec_skip_nal (GstLibde265Dec * dec, const guint8 * nal,
+    gsize size, gboolean clipped, gboolean * by_qos)
+{
+  int type;
+  int tid;
+
+  if (size < 2) {
+    return FALSE;
+  }
+
+  type = GST_LIBDE265_NAL_TYPE (nal);
+  if (type == GST_LIBDE265_NAL_EOS) {
+    dec->no_rasl_output = TRUE;
+    return FALSE;
+  } else if (!GST_LIBDE265_NAL_IS_VCL (type)) {
+    return FALSE;
+  }
+
+  if (GST_LIBDE265_NAL_IS_IRAP (type)) {
+    if (size > 2 && GST_LIBDE265_NAL_FIRST_SLICE (nal)) {
+      // RASL pictures can't be decoded if decoding starts at this picture
+      dec->skip_rasl = dec->no_rasl_output || GST_LIBDE265_NAL_IS_BLA (type);
+      dec->no_rasl_output = FALSE;
+    }
+  } else if (_gst_libde265_dec_irap_only (dec)) {
+    *by_qos = FALSE;
+    return TRUE;
+  } else if (GST_LIBDE265_NAL_IS_RASL (type) && dec->skip_rasl) {
+    *by_qos = FALSE;
+    return TRUE;
+  }
+
+  tid = GST_LIBDE265_NAL_TEMPORAL_ID (nal);
+  _gst_libde265_dec_update_tid (dec, type, tid);
+  if (tid > dec->highest_tid) {
+    *by_qos = (tid < _gst_libde265_dec_sub_layers (dec));
+    return TRUE;
+  }
+  // sub-layer non-reference pictures are only referenced by pictures of
+  // higher sub-layers, which are not decoded
+  if (dec->qos_level > 0 && tid == dec->highest_tid
+      && GST_LIBDE265_NAL_IS_SLNR (type)) {
+    *by_qos = TRUE;
+    return TRUE;
+  }
+  // pictures of the highest sub-layer of the stream that are sub-layer
+  // non-reference pictures are not referenced at all
+  if (clipped && dec->have_sps && tid == dec->sps.max_sub_layers - 1
+      && GST_LIBDE265_NAL_IS_SLNR (type)) {
+    *by_qos = FALSE;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+#if GST_CHECK_VERSION(1,0,0)
+/*
+ * Adjust the number of pictures that are skipped before decoding from the
+ * time left until the frame is due downstream.
+ */
+static void
+_gst_libde265_dec_update_qos (GstLibde265Dec * dec, VIDEO_FRAME * frame)
+{
+  GstClockTimeDiff deadline =
+      gst_video_decoder_get_max_decode_time (GST_VIDEO_DECODER (dec), frame);
+  int max_level = dec->have_sps ? dec->sps.max_sub_layers : 1;
+  int level = dec->qos_level;
+
+  if (deadline < 0) {
+    dec->qos_on_time = 0;
+    if (level < max_level && ++dec->qos_late >= QOS_LATE_FRAMES) {
+      level++;
+    }
+  } else {
+    dec->qos_late = 0;
+    if (level > 0 && ++dec->qos_on_time >= QOS_RECOVER_FRAMES) {
+      level--;
+    }
+  }
+
+  if (level != dec->qos_level) {
+    dec->qos_level = level;
+    dec->qos_late = 0;
+    dec->qos_on_time = 0;
+    GST_DEBUG_OBJECT (dec, "QoS level %d, decoding temporal sub-layers up "
+        "to %d%s", level, _gst_libde265_dec_wanted_tid (dec),
+        level > 0 ? " without their non-reference pictures" : "");
+  }
+}
+#endif
+
+#if GST_CHECK_VERSION(1,0,0)
+// number of GOPs that are decoded or wait for output at the same time
+static inline int
+_gst_libde265_dec_gops_in_flight (GstLibde265Dec * dec)
+{
+  return dec->max_gops_in_flight > 0 ? dec->max_gops_in_flight
+      : dec->gop_parallel + 1;
+}
+
+/*
+ * Report the latency caused by picture reordering in the stream, the
+ * SPS values of the highest decoded sub-layer are used. In GOP-parallel
+ * decoding, pictures also wait for the GOPs before them.
+ */
+static void
+_gst_libde265_dec_update_latency (GstLibde265Dec * dec)
+{
+  const GstVideoInfo *info;
+  int tid;
+  int min_frames;
+  int max_frames;
+
+  if (!dec->have_sps || dec->output_state == NULL) {
+    return;
+  }
+  info = &dec->output_state->info;
+  if (info->fps_n <= 0 || info->fps_d <= 0) {
+    return;
+  }
+
+  tid = MIN (dec->highest_tid, dec->sps.max_sub_layers - 1);
+  min_frames = dec->sps.max_num_reorder_pics[tid];
+  max_frames = dec->sps.max_dec_pic_buffering[tid];
+  if (dec->sps.max_latency_increase_plus1[tid] != 0) {
+    // SpsMaxLatencyPictures
+    max_frames = dec->sps.max_num_reorder_pics[tid] +
+        dec->sps.max_latency_increase_plus1[tid] - 1;
+  }
+  max_frames = MAX (max_frames, min_frames);
+  if (!dec->low_latency) {
+    // a picture is only finished once the next one is pushed
+    min_frames++;
+    max_frames++;
+  }
+  if (dec->async_thread != NULL) {
+    max_frames += dec->async_size;
+  }
+  if (dec->gop_workers != NULL) {
+    min_frames += dec->gop_length * dec->gop_worker_count;
+    max_frames += dec->gop_length * _gst_libde265_dec_gops_in_flight (dec);
+  }
+
+  if (min_frames != dec->latency_min_frames
+      || max_frames != dec->latency_max_frames) {
+    GstClockTime min_latency = gst_util_uint64_scale_int (min_frames *
+        GST_SECOND, info->fps_d, info->fps_n);
+    GstClockTime max_latency = gst_util_uint64_scale_int (max_frames *
+        GST_SECOND, info->fps_d, info->fps_n);
+    GST_DEBUG_OBJECT (dec, "Latency is %d to %d frames (%" GST_TIME_FORMAT
+        " - %" GST_TIME_FORMAT ")", min_frames, max_frames,
+        GST_TIME_ARGS (min_latency), GST_TIME_ARGS (max_latency));
+    dec->latency_min_frames = min_frames;
+    dec->latency_max_frames = max_frames;
+    gst_video_decoder_set_latency (GST_VIDEO_DECODER (dec), min_latency,
+        max_latency);
+  }
+}
+#endif
+
+/*
+ * Look at a NAL unit before it is passed to the decoder to pick up the
+ * stream parameters the worker pool is sized from.
+ */
+static void
+_gst_libde265_dec_inspect_nal (GstLibde265Dec * dec, const guint8 * nal,
+    gsize size)
+{
+  int type;
+
+  if (size < 2) {
+    return;
+  }
+
+  type = GST_LIBDE265_NAL_TYPE (nal);
+  if (type == GST_LIBDE265_NAL_SPS) {
+    GstLibde265SPS sps;
+    if (gst_libde265_nal_parse_sps (nal, size, &sps)) {
+      dec->sps = sps;
+      dec->have_sps = TRUE;
+#if GST_CHECK_VERSION(1,0,0)
+      _gst_libde265_dec_update_latency (dec);
+#endif
+    }
+  } else if (type == GST_LIBDE265_NAL_PPS) {
+    GstLibde265PPS pps;
+    if (gst_libde265_nal_parse_pps (nal, size, &pps)) {
+      dec->pps = pps;
+      dec->have_pps = TRUE;
+    }
+  } else if (GST_LIBDE265_NAL_IS_VCL (type) && dec->threads_pending
+      && dec->have_sps) {
+    _gst_libde265_dec_start_threads (dec);
+    return;
+  } else {
+    return;
+  }
+
+  if (!dec->threads_pending && _gst_libde265_dec_threads_from_stream (dec)
+      && dec->have_sps && !_gst_libde265_dec_gop_active (dec)) {
+    // the worker pool of a running decoder can't be resized, the context
+    // is replaced at the IRAP picture that activates the new parameters
+    gboolean resize =
+        _gst_libde265_dec_wanted_threads (dec) != dec->threads_wanted;
+    if (resize && !dec->threads_resize) {
+      GST_DEBUG_OBJECT (dec, "Stream parameters changed, resizing worker "
+          "threads at the next IRAP picture");
+    }
+    dec->threads_resize = resize;
+  }
+}
+
+static void
+_gst_libde265_dec_inspect_data (GstLibde265Dec * dec, const guint8 * data,
+    gsize size)
+{
+  const guint8 *end = data + size;
+  const guint8 *nal = gst_libde265_nal_find_start_code (data, end);
+
+  while (nal != NULL) {
+    const guint8 *next;
+    nal += 3;
+    next = gst_libde265_nal_find_start_code (nal, end);
+    _gst_libde265_dec_inspect_nal (dec, nal, (next ? next : end) - nal);
+    nal = next;
+  }
+}
+
+static gboolean
+_gst_libde265_dec_decode_codec_data (GstLibde265Dec * dec)
+{
+  de265_error err;
+  int more;
+
+  de265_push_end_of_NAL (dec->ctx);
+  do {
+    err = de265_decode (dec->ctx, &more);
+    switch (err) {
+      case DE265_OK:
+        break;
+
+      case DE265_ERROR_IMAGE_BUFFER_FULL:
+      case DE265_ERROR_WAITING_FOR_INPUT_DATA:
+        // not really an error
+        more = 0;
+        break;
+
+      default:
+        if (!de265_isOK (err)) {
+          GST_ELEMENT_ERROR (dec, STREAM, DECODE,
+              ("Failed to decode codec data: %s (code=%d)",
+                  de265_get_error_text (err), err), (NULL));
+          return FALSE;
+        }
+    }
+  } while (more);
+  return TRUE;
+}
+
+static guint
+_gst_libde265_dec_hash_codec_data (const guint8 * data, gsize size)
+{
+  // FNV-1a, codec data is only a few hundred bytes
+  guint hash = 2166136261u;
+  gsize i;
+  for (i = 0; i < size; i++) {
+    hash = (hash ^ data[i]) * 16777619u;
+  }
+  return hash;
+}
+
+/*
+ * Extract the parameter sets from codec data. The input mode is detected
+ * from its format. Returns NULL if the codec data is invalid.
+ */
+static struct GstLibde265ParamSets *
+_gst_libde265_dec_parse_codec_data (GstLibde265Dec * dec, const guint8 * data,
+    gsize size, guint hash)
+{
+  static const guint8 start_code[] = { 0, 0, 1 };
+  struct GstLibde265ParamSets *sets = g_new0 (struct GstLibde265ParamSets, 1);
+
+  sets->hash = hash;
+  // g_memdup is deprecated and g_memdup2 needs GLib 2.68
+  sets->codec_data = g_malloc (size);
+  memcpy (sets->codec_data, data, size);
+  sets->codec_data_size = size;
+  sets->length_size = dec->length_size;
+  sets->nals = g_byte_array_sized_new (size + 16);
+  if (size > 3 && (data[0] || data[1] || data[2] > 1)) {
+    // encoded in "hvcC" format (assume version 0)
+    sets->mode = GST_TYPE_LIBDE265_DEC_PACKETIZED;
+    if (size > 22) {
+      int i;
+      if (data[0] != 0) {
+        GST_ELEMENT_WARNING (dec, STREAM,
+            DECODE, ("Unsupported extra data version %d, decoding may fail",
+                data[0]), (NULL));
+      }
+      sets->length_size = (data[21] & 3) + 1;
+      int num_param_sets = data[22];
+      int pos = 23;
+      for (i = 0; i < num_param_sets; i++) {
+        int j;
+        if (pos + 3 > size) {
+          GST_ELEMENT_ERROR (dec, STREAM, DECODE,
+              ("Buffer underrun in extra header (%d >= %ld)", pos + 3,
+                  size), (NULL));
+          goto error;
+        }
+        // ignore flags + NAL type (1 byte)
+        int nal_count = data[pos + 1] << 8 | data[pos + 2];
+        pos += 3;
+        for (j = 0; j < nal_count; j++) {
+          if (pos + 2 > size) {
+            GST_ELEMENT_ERROR (dec, STREAM, DECODE,
+                ("Buffer underrun in extra nal header (%d >= %ld)", pos + 2,
+                    size), (NULL));
+            goto error;
+          }
+          int nal_size = data[pos] << 8 | data[pos + 1];
+          if (pos + 2 + nal_size > size) {
+            GST_ELEMENT_ERROR (dec, STREAM, DECODE,
+                ("Buffer underrun in extra nal (%d >= %ld)",
+                    pos + 2 + nal_size, size), (NULL));
+            goto error;
+          }
+          g_byte_array_append (sets->nals, start_code, sizeof (start_code));
+          g_byte_array_append (sets->nals, data + pos + 2, nal_size);
+          pos += 2 + nal_size;
+        }
+      }
+    }
+    GST_DEBUG ("Assuming packetized data (%d bytes length)",
+        sets->length_size);
+  } else {
+    sets->mode = GST_TYPE_LIBDE265_DEC_RAW;
+    GST_DEBUG ("Assuming non-packetized data");
+    g_byte_array_append (sets->nals, data, size);
+  }
+  return sets;
+
+error:
+  _gst_libde265_dec_free_param_sets (sets);
+  return NULL;
+}
+
+/*
+ * Look up the parameter sets of the given codec data, parsing it if it
+ * isn't cached yet. The entry is moved to the front of the cache.
+ */
+static struct GstLibde265ParamSets *
+_gst_libde265_dec_get_param_sets (GstLibde265Dec * dec, const guint8 * data,
+    gsize size)
+{
+  guint hash = _gst_libde265_dec_hash_codec_data (data, size);
+  struct GstLibde265ParamSets *sets;
+  GList *walk;
+
+  for (walk = dec->param_set_cache; walk != NULL; walk = walk->next) {
+    sets = (struct GstLibde265ParamSets *) walk->data;
+    if (sets->hash == hash && sets->codec_data_size == size
+        && memcmp (sets->codec_data, data, size) == 0) {
+      dec->param_set_cache =
+          g_list_remove_link (dec->param_set_cache, walk);
+      dec->param_set_cache = g_list_concat (walk, dec->param_set_cache);
+      return sets;
+    }
+  }
+
+  sets = _gst_libde265_dec_parse_codec_data (dec, data, size, hash);
+  if (sets == NULL) {
+    return NULL;
+  }
+  dec->param_set_cache = g_list_prepend (dec->param_set_cache, sets);
+  if (g_list_length (dec->param_set_cache) > PARAM_SET_CACHE_SIZE) {
+    GList *last = g_list_last (dec->param_set_cache);
+    _gst_libde265_dec_free_param_sets (last->data);
+    dec->param_set_cache = g_list_delete_link (dec->param_set_cache, last);
+  }
+  return sets;
+}
+
+/*
+ * Pass the current parameter sets to the decoder.
+ */
+static gboolean
+_gst_libde265_dec_push_param_sets (GstLibde265Dec * dec)
+{
+  struct GstLibde265ParamSets *sets = dec->param_sets;
+  de265_error err;
+
+  // in-band parameter sets may have replaced them since they were pushed
+  _gst_libde265_dec_inspect_data (dec, sets->nals->data, sets->nals->len);
+  err = de265_push_data (dec->ctx, sets->nals->data, sets->nals->len, 0, NULL);
+  if (!de265_isOK (err)) {
+    GST_ELEMENT_ERROR (dec, STREAM, DECODE,
+        ("Failed to push codec data: %s (code=%d)",
+            de265_get_error_text (err), err), (NULL));
+    return FALSE;
+  }
+  return _gst_libde265_dec_decode_codec_data (dec);
+}
+
+// keep the in-band parameter sets of the stream, the most recent one last
+static void
+_gst_libde265_dec_remember_param_set (GstLibde265Dec * dec,
+    const guint8 * nal, gsize size)
+{
+  GBytes *bytes = g_bytes_new (nal, size);
+  GList *walk;
+
+  for (walk = dec->param_history.head; walk != NULL; walk = walk->next) {
+    if (g_bytes_equal (walk->data, bytes)) {
+      g_bytes_unref (walk->data);
+      g_queue_delete_link (&dec->param_history, walk);
+      break;
+    }
+  }
+  g_queue_push_tail (&dec->param_history, bytes);
+  if (dec->param_history.length > PARAM_HISTORY_SIZE) {
+    g_bytes_unref (g_queue_pop_head (&dec->param_history));
+  }
+}
+
+/*
+ * Pass the in-band parameter sets seen so far to the decoder, after those
+ * of the caps.
+ */
+static gboolean
+_gst_libde265_dec_push_param_history (GstLibde265Dec * dec)
+{
+  GList *walk;
+
+  if (g_queue_is_empty (&dec->param_history)) {
+    return TRUE;
+  }
+  for (walk = dec->param_history.head; walk != NULL; walk = walk->next) {
+    gsize size;
+    const guint8 *nal = g_bytes_get_data ((GBytes *) walk->data, &size);
+    _gst_libde265_dec_inspect_nal (dec, nal, size);
+    de265_error err = de265_push_NAL (dec->ctx, nal, size, 0, NULL);
+    if (!de265_isOK (err)) {
+      GST_ELEMENT_ERROR (dec, STREAM, DECODE,
+          ("Failed to push parameter sets: %s (code=%d)",
+              de265_get_error_text (err), err), (NULL));
+      return FALSE;
+    }
+  }
+  return _gst_libde265_dec_decode_codec_data (dec);
+}
+
+/*
+ * Pass the parameter sets known so far to a context that restarts at an
+ * IRAP picture, the stream doesn't necessarily repeat them before it.
+ */
+static gboolean
+_gst_libde265_dec_restore_param_sets (GstLibde265Dec * dec)
+{
+  if (dec->param_sets != NULL && !_gst_libde265_dec_push_param_sets (dec)) {
+    return FALSE;
+  }
+  return _gst_libde265_dec_push_param_history (dec);
+}
+
+static gboolean
+gst_libde265_dec_set_format (VIDEO_DECODER_BASE * parse, VIDEO_STATE * state)
+{
+  GstLibde265Dec *dec = GST_LIBDE265_DEC (parse);
+
+#if GST_CHECK_VERSION(1,0,0)
+  // frames of the previous format are decoded with the current context
+  _gst_libde265_dec_async_wait (dec, FALSE);
+  _gst_libde265_dec_gop_drain_all (dec);
+  if (dec->input_state != NULL) {
+    gst_video_codec_state_unref (dec->input_state);
+  }
+  dec->input_state = state;
+  if (state != NULL) {
+    gst_video_codec_state_ref (state);
+  }
+#endif
+  if (state != NULL && state->caps != NULL) {
+    GstStructure *str;
+    const GValue *value;
+    str = gst_caps_get_structure (state->caps, 0);
+    if ((value = gst_structure_get_value (str, "codec_data"))) {
+#if GST_CHECK_VERSION(1,0,0)
+      GstMapInfo info;
+#endif
+      guint8 *data;
+      gsize size;
+      GstBuffer *buf;
+
+      buf = gst_value_get_buffer (value);
+#if GST_CHECK_VERSION(1,0,0)
+      if (!gst_buffer_map (buf, &info, GST_MAP_READ)) {
+        GST_ELEMENT_ERROR (parse, STREAM, DECODE,
+            ("Failed to map codec data"), (NULL));
+        return FALSE;
+      }
+      data = info.data;
+      size = info.size;
+#else
+      data = GST_BUFFER_DATA (buf);
+      size = GST_BUFFER_SIZE (buf);
+#endif
+      struct GstLibde265ParamSets *sets =
+          _gst_libde265_dec_get_param_sets (dec, data, size);
+#if GST_CHECK_VERSION(1,0,0)
+      gst_buffer_unmap (buf, &info);
+#endif
+      if (sets == NULL) {
+        return FALSE;
+      }
+      if (sets == dec->param_sets) {
+        // renegotiation with the same codec data, the decoder already
+        // has its parameter sets
+        GST_DEBUG_OBJECT (dec, "Codec data unchanged");
+      } else {
+        dec->param_sets = sets;
+        dec->mode = sets->mode;
+        dec->length_size = sets->length_size;
+        if (!_gst_libde265_dec_push_param_sets (dec)) {
+          return FALSE;
+        }
+      }
+    } else if ((value = gst_structure_get_value (str, "stream-format"))) {
+      const gchar *str = g_value_get_string (value);
+      if (strcmp (str, "byte-stream") == 0) {
+        dec->mode = GST_TYPE_LIBDE265_DEC_RAW;
+        GST_DEBUG ("Assuming raw byte-stream");
+      }
+    }
+  }
+
+#if GST_CHECK_VERSION(1,0,0)
+  // raw input that isn't aligned to access units is split by the parse
+  // function, so every frame holds exactly one picture
+  gboolean aligned = FALSE;
+  if (state != NULL && state->caps != NULL) {
+    const gchar *alignment =
+        gst_structure_get_string (gst_caps_get_structure (state->caps, 0),
+        "alignment");
+    aligned = alignment != NULL && strcmp (alignment, "au") == 0;
+  }
+  gboolean packetized = dec->mode == GST_TYPE_LIBDE265_DEC_PACKETIZED
+      || aligned;
+  GST_DEBUG_OBJECT (dec, "Input is %s", packetized ? "packetized" :
+      "split into access units");
+  gst_video_decoder_set_packetized (parse, packetized);
+  dec->au_input = dec->mode == GST_TYPE_LIBDE265_DEC_RAW;
+#endif
+
+  return TRUE;
+}
+
+#if GST_CHECK_VERSION(1,0,0)
+/*
+ * Split raw input into access units. Data is added to the current frame
+ * as soon as it is known to belong to it, the adapter only keeps what may
+ * be the start of the next access unit.
+ */
+static GstFlowReturn
+gst_libde265_dec_parse (VIDEO_DECODER_BASE * parse, VIDEO_FRAME * frame,
+    GstAdapter * adapter, gboolean at_eos)
+{
+  GstLibde265Dec *dec = GST_LIBDE265_DEC (parse);
+  gsize size = gst_adapter_available (adapter);
+  const guint8 *data;
+  const guint8 *end;
+  const guint8 *pos;
+  const guint8 *nal;
+  gsize consumed;
+
+  if (at_eos) {
+    // the remaining data completes the last access unit
+    gst_video_decoder_add_to_frame (parse, size);
+    dec->parse_have_vcl = FALSE;
+    return HAVE_FRAME (parse);
+  }
+
+  data = gst_adapter_map (adapter, size);
+  end = data + size;
+  pos = data;
+  // start code, NAL unit header and the first byte of a slice header
+  while ((nal = gst_libde265_nal_find_start_code (pos, end)) != NULL
+      && end - nal >= 6) {
+    int type = GST_LIBDE265_NAL_TYPE (nal + 3);
+    if (dec->parse_have_vcl && gst_libde265_nal_starts_access_unit (nal + 3)) {
+      gst_adapter_unmap (adapter);
+      if (nal > data) {
+        gst_video_decoder_add_to_frame (parse, nal - data);
+      }
+      dec->parse_have_vcl = FALSE;
+      return HAVE_FRAME (parse);
+    }
+    if (GST_LIBDE265_NAL_IS_VCL (type)) {
+      dec->parse_have_vcl = TRUE;
+      if (GST_LIBDE265_NAL_IS_IRAP (type)) {
+        GST_VIDEO_CODEC_FRAME_SET_SYNC_POINT (frame);
+      }
+    }
+    pos = nal + 3;
+  }
+  gst_adapter_unmap (adapter);
+
+  if (nal != NULL) {
+    // the NAL unit header is incomplete
+    consumed = nal - data;
+  } else {
+    // the last bytes may be part of a start code continued in the next
+    // buffer
+    consumed = MAX ((gsize) (pos - data), size > 2 ? size - 2 : 0);
+  }
+  if (consumed == 0) {
+    return NEED_DATA_RESULT;
+  }
+  gst_video_decoder_add_to_frame (parse, consumed);
+  return GST_FLOW_OK;
+}
+#endif
+
+/*
+ * Pass raw input to the decoder. If only IRAP pictures are decoded, the
+ * ranges of other slice NAL units are left out, a skipped NAL unit may
+ * continue in the next buffer.
+ */
+static de265_error
+_gst_libde265_dec_push_raw (GstLibde265Dec * dec, const guint8 * data,
+    gsize size, de265_PTS pts)
+{
+  const guint8 *end = data + size;
+  const guint8 *nal;
+  de265_error ret = DE265_OK;
+
+  if (!_gst_libde265_dec_irap_only (dec)) {
+    dec->raw_skipping = FALSE;
+    return de265_push_data (dec->ctx, data, size, pts, NULL);
+  }
+
+  nal = gst_libde265_nal_find_start_code (data, end);
+  if (nal != data && !dec->raw_skipping) {
+    // continuation of the last NAL unit of the previous buffer
+    ret = de265_push_data (dec->ctx, data, (nal ? nal : end) - data, pts,
+        NULL);
+  }
+  while (nal != NULL && ret == DE265_OK) {
+    const guint8 *next = gst_libde265_nal_find_start_code (nal + 3, end);
+    const guint8 *nal_end = next ? next : end;
+    if (nal_end - nal >= 5) {
+      int type = GST_LIBDE265_NAL_TYPE (nal + 3);
+      dec->raw_skipping = GST_LIBDE265_NAL_IS_VCL (type)
+          && !GST_LIBDE265_NAL_IS_IRAP (type);
+    } else {
+      // NAL unit header is in the next buffer, keep the data
+      dec->raw_skipping = FALSE;
+    }
+    if (!dec->raw_skipping) {
+      ret = de265_push_data (dec->ctx, nal, nal_end - nal, pts, NULL);
+    }
+    nal = next;
+  }
+  return ret;
+}
+
+static GstFlowReturn
+_gst_libde265_dec_finish_frame (VIDEO_DECODER_BASE * parse,
+    VIDEO_FRAME * frame, de265_PTS pts)
+{
+  GstLibde265Dec *dec = GST_LIBDE265_DEC (parse);
+
+  FRAME_PTS (frame) = (GstClockTime) pts;
+  if (dec->rate_divider > 1
+      && GST_CLOCK_TIME_IS_VALID (FRAME_DURATION (frame))) {
+    // the frames of the skipped sub-layers are never output
+    FRAME_DURATION (frame) *= dec->rate_divider;
+  }
+  return FINISH_FRAME (parse, frame);
+}
+
+#if GST_CHECK_VERSION(1,0,0)
+// pictures that are only used for decoding have no codec frame
+static inline gboolean
+_gst_libde265_dec_is_direct (const struct de265_image *img)
+{
   struct GstLibde265FrameRef *ref =
       (struct GstLibde265FrameRef *) de265_get_image_plane_user_data (img, 0);
-  if (ref != NULL) {
+  return ref != NULL && ref->frame != NULL;
+}
+
+static GstFlowReturn
+_gst_libde265_dec_finish_direct (VIDEO_DECODER_BASE * parse,
+    const struct de265_image *img)
+{
+  struct GstLibde265FrameRef *ref =
+      (struct GstLibde265FrameRef *) de265_get_image_plane_user_data (img, 0);
+  VIDEO_FRAME *out_frame = gst_video_codec_frame_ref (ref->frame);
+
+  gst_buffer_replace (&out_frame->output_buffer, ref->buffer);
+  gst_buffer_replace (&ref->buffer, NULL);
+  return _gst_libde265_dec_finish_frame (parse, out_frame,
+      de265_get_image_PTS (img));
+}
+#endif
+
+// set up the source of a plane copy, without scaling
+static void
+_gst_libde265_dec_copy_source (GstLibde265CopyPlane * p,
+    const struct de265_image *img, int plane, int dst_bits)
+{
+  p->src_width = de265_get_image_width (img, plane);
+  p->src_height = de265_get_image_height (img, plane);
+  p->src = de265_get_image_plane (img, plane, &p->src_stride);
+  p->src_v = NULL;
+  p->v_stride = 0;
+  p->src_bits = de265_get_bits_per_pixel (img, plane);
+  p->dst_bits = dst_bits;
+  p->dst_width = p->src_width;
+  p->dst_height = p->src_height;
+}
+
+#if GST_CHECK_VERSION(1,0,0)
+// bits per sample in the output buffer
+static int
+_gst_libde265_dec_sample_bits (GstVideoFormat format)
+{
+  const GstVideoFormatInfo *format_info = gst_video_format_get_info (format);
+  // formats like P010 keep their samples in the most significant bits
+  return GST_VIDEO_FORMAT_INFO_BITS (format_info)
+      + GST_VIDEO_FORMAT_INFO_SHIFT (format_info, 0);
+}
+
+// set up the destination of a plane copy into a mapped video frame
+static void
+_gst_libde265_dec_copy_dest (GstLibde265CopyPlane * p,
+    const struct de265_image *img, GstVideoFrame * vframe, int plane,
+    int scale)
+{
+  p->dst = GST_VIDEO_FRAME_PLANE_DATA (vframe, plane);
+  p->dst_stride = GST_VIDEO_FRAME_PLANE_STRIDE (vframe, plane);
+  if (scale > 1) {
+    p->dst_width = GST_VIDEO_FRAME_COMP_WIDTH (vframe, plane);
+    p->dst_height = GST_VIDEO_FRAME_COMP_HEIGHT (vframe, plane);
+  }
+  if (plane == 1 && GST_VIDEO_FRAME_N_PLANES (vframe) == 2) {
+    // semi-planar output, chroma planes are interleaved in one pass
+    p->src_v = de265_get_image_plane (img, 2, &p->v_stride);
+  }
+}
+#endif
+
+/*
+ * Find the next NAL unit in the input data of a frame, it is either
+ * prefixed by a length field or, for access units in raw mode, by a start
+ * code. Returns 1 if a NAL unit was found, 0 at the end of the data and -1
+ * if a length field exceeds the data.
+ */
+static int
+_gst_libde265_dec_next_nal (GstLibde265Dec * dec, const guint8 ** pos,
+    const guint8 * end, const guint8 ** nal, gsize * nal_size)
+{
+  const guint8 *data = *pos;
+
+  if (dec->mode == GST_TYPE_LIBDE265_DEC_PACKETIZED) {
+    gsize size = 0;
+    int i;
+    if (data + dec->length_size > end) {
+      return 0;
+    }
+    for (i = 0; i < dec->length_size; i++) {
+      size = (size << 8) | data[i];
+    }
+    data += dec->length_size;
+    if (size > (gsize) (end - data)) {
+      return -1;
+    }
+    *nal = data;
+    *nal_size = size;
+    *pos = data + size;
+    return 1;
+  }
+
+  data = gst_libde265_nal_find_start_code (data, end);
+  if (data == NULL) {
+    return 0;
+  }
+  data += 3;
+  const guint8 *next = gst_libde265_nal_find_start_code (data, end);
+  const guint8 *nal_end = next ? next : end;
+  *pos = nal_end;
+  // drop the zero bytes in front of the next start code, a NAL unit
+  // never ends with a zero byte
+  while (nal_end > data && nal_end[-1] == 0) {
+    nal_end--;
+  }
+  *nal = data;
+  *nal_size = nal_end - data;
+  return 1;
+}
+
+/*
+ * Output a decoded picture with the given input frame, its contents are
+ * copied to the output buffer unless it was direct rendered.
+ */
+static GstFlowReturn
+_gst_libde265_dec_output_picture (VIDEO_DECODER_BASE * parse,
+    VIDEO_FRAME * frame, const struct de265_image *img)
+{
+  GstLibde265Dec *dec = GST_LIBDE265_DEC (parse);
+
+#if GST_CHECK_VERSION(1,0,0)
+  if (_gst_libde265_dec_is_direct (img)) {
     // decoder is using direct rendering
     gst_video_codec_frame_unref (frame);
-    VIDEO_FRAME *out_frame = gst_video_codec_frame_ref (ref->frame);
-    gst_buffer_replace (&out_frame->output_buffer, ref->buffer);
-    gst_buffer_replace (&ref->buffer, NULL);
-    FRAME_PTS (out_frame) = (GstClockTime) de265_get_image_PTS (img);
-    return FINISH_FRAME (parse, out_frame);
+    return _gst_libde265_dec_finish_direct (parse, img);
+  }
+
+  // the picture keeps the decode-only state and duration of its own frame
+  VIDEO_FRAME *source =
+      _gst_libde265_dec_find_source_frame (dec, de265_get_image_PTS (img));
+  if (source == NULL) {
+    source = gst_video_codec_frame_ref (frame);
+  }
+  gboolean decode_only = _gst_libde265_dec_upstream_decode_only (source);
+  gboolean clipped = !decode_only
+      && _gst_libde265_dec_is_clipped (dec, de265_get_image_PTS (img),
+      FRAME_DURATION (source));
+  gst_video_codec_frame_unref (source);
+  if (decode_only || clipped) {
+    // the base class drops the frame, don't allocate or convert it
+    GST_LOG_OBJECT (dec, "Picture is not shown, not converting it");
+    if (clipped) {
+      dec->clipped_frames++;
+    }
+    GST_VIDEO_CODEC_FRAME_FLAG_SET (frame,
+        GST_VIDEO_CODEC_FRAME_FLAG_DECODE_ONLY);
+    return _gst_libde265_dec_finish_frame (parse, frame,
+        de265_get_image_PTS (img));
+  }
+
+  // set by handle_frame for frames that have no picture
+  GST_VIDEO_CODEC_FRAME_FLAG_UNSET (frame,
+      GST_VIDEO_CODEC_FRAME_FLAG_DECODE_ONLY);
+#endif
+
+  int bits_per_pixel = MAX (MAX (de265_get_bits_per_pixel (img, 0),
+          de265_get_bits_per_pixel (img, 1)), de265_get_bits_per_pixel (img,
+          2));
+
+  GstVideoFormat format =
+      _gst_libde265_get_video_format (de265_get_chroma_format (img),
+      bits_per_pixel);
+  if (format == GST_VIDEO_FORMAT_UNKNOWN) {
+    GST_ERROR_OBJECT (dec, "Unsupported image format");
+    return GST_FLOW_ERROR;
+  }
+#if GST_CHECK_VERSION(1,0,0)
+  format = _gst_libde265_dec_output_format (dec, format);
+#endif
+
+  int scale = dec->output_scale;
+  GstFlowReturn result =
+      _gst_libde265_image_available (parse,
+      MAX (1, de265_get_image_width (img, 0) / scale),
+      MAX (1, de265_get_image_height (img, 0) / scale), NULL, format);
+  if (result != GST_FLOW_OK) {
+    GST_ERROR_OBJECT (dec, "Failed to notify about available image");
+    return result;
+  }
+
+  result = ALLOC_OUTPUT_FRAME (parse, frame);
+  if (result != GST_FLOW_OK) {
+    GST_ERROR_OBJECT (dec, "Failed to allocate output frame");
+    return result;
+  }
+
+#if GST_CHECK_VERSION(1,0,0)
+  if (dec->use_crop_meta) {
+    // output buffer has the coded size, image is copied to its top left
+    _gst_libde265_dec_set_crop (frame->output_buffer, 0, 0, dec->width,
+        dec->height);
+  }
+
+  GstVideoFrame vframe;
+  if (!gst_video_frame_map (&vframe, &dec->output_state->info,
+          frame->output_buffer, GST_MAP_WRITE)) {
+    GST_ERROR_OBJECT (dec, "Failed to map output buffer");
+    return GST_FLOW_ERROR;
+  }
+
+  int max_bits_per_pixel = _gst_libde265_dec_sample_bits (format);
+  int planes = GST_VIDEO_FRAME_N_PLANES (&vframe);
+#else
+  uint8_t *dest = GST_BUFFER_DATA (frame->src_buffer);
+  int max_bits_per_pixel = 8;
+  int planes = de265_get_chroma_format (img) == de265_chroma_mono ? 1 : 3;
+#endif
+
+  GstLibde265CopyPlane copy[3];
+  int plane;
+  for (plane = 0; plane < planes; plane++) {
+    GstLibde265CopyPlane *p = &copy[plane];
+    _gst_libde265_dec_copy_source (p, img, plane, max_bits_per_pixel);
+#if GST_CHECK_VERSION(1,0,0)
+    _gst_libde265_dec_copy_dest (p, img, &vframe, plane, scale);
+#else
+    p->dst = dest + gst_video_format_get_component_offset (format, plane,
+        dec->width, dec->height);
+    p->dst_stride = gst_video_format_get_row_stride (format, plane,
+        dec->width);
+    if (scale > 1) {
+      p->dst_width = gst_video_format_get_component_width (format, plane,
+          dec->width);
+      p->dst_height = gst_video_format_get_component_height (format, plane,
+          dec->height);
+    }
+#endif
+  }
+
+  gint64 convert_start = g_get_monotonic_time ();
+  int bands = gst_libde265_copy_planes (copy, planes, scale);
+  gint64 convert_duration = g_get_monotonic_time () - convert_start;
+  dec->convert_time += convert_duration;
+  if (bands > 1) {
+    dec->parallel_copy_time += convert_duration;
+    dec->parallel_copies++;
+  }
+#if GST_CHECK_VERSION(1,0,0)
+  gst_video_frame_unmap (&vframe);
+#endif
+  return _gst_libde265_dec_finish_frame (parse, frame,
+      de265_get_image_PTS (img));
+}
+
+/*
+ * Output the pictures the context still holds before it is replaced.
+ * Pictures that were not direct rendered are finished with the oldest
+ * frames, "current" is the frame that is being decoded and has to keep
+ * its own picture.
+ */
+static GstFlowReturn
+_gst_libde265_dec_drain_context (GstLibde265Dec * dec, VIDEO_FRAME * current)
+{
+  VIDEO_DECODER_BASE *parse = (VIDEO_DECODER_BASE *) dec;
+  const struct de265_image *img;
+  GstFlowReturn result = GST_FLOW_OK;
+  de265_error ret;
+  int more;
+
+  de265_flush_data (dec->ctx);
+  do {
+    ret = de265_decode (dec->ctx, &more);
+    while (result == GST_FLOW_OK
+        && (img = de265_get_next_picture (dec->ctx)) != NULL) {
+#if GST_CHECK_VERSION(1,0,0)
+      if (_gst_libde265_dec_is_direct (img)) {
+        result = _gst_libde265_dec_finish_direct (parse, img);
+        continue;
+      }
+#endif
+      VIDEO_FRAME *frame = GET_OLDEST_FRAME (parse);
+      if (frame == NULL || frame == current) {
+        GST_DEBUG_OBJECT (dec, "No frame left for a pending picture");
+#if GST_CHECK_VERSION(1,0,0)
+        if (frame != NULL) {
+          gst_video_codec_frame_unref (frame);
+        }
+#endif
+        continue;
+      }
+      result = _gst_libde265_dec_output_picture (parse, frame, img);
+    }
+  } while (more && result == GST_FLOW_OK && (ret == DE265_OK
+          || ret == DE265_ERROR_IMAGE_BUFFER_FULL));
+  return result;
+}
+
+/*
+ * Check if the context should be replaced at the next IRAP picture or
+ * flush to change the number of worker threads.
+ */
+static gboolean
+_gst_libde265_dec_context_outdated (GstLibde265Dec * dec)
+{
+  if (_gst_libde265_dec_gop_active (dec)) {
+    // the GOP workers keep their share until the element is stopped
+    return FALSE;
+  }
+  return dec->threads_resize || (dec->thread_budget > 0
+      && gst_libde265_threads_needs_rebalance (dec));
+}
+
+/*
+ * Replace the context before an IRAP picture, the worker pool of a
+ * running context can't be resized. Decoding continues at the IRAP
+ * picture like after a flush, the new context gets the parameter sets of
+ * the caps and of the stream so far.
+ */
+static GstFlowReturn
+_gst_libde265_dec_renew_context (GstLibde265Dec * dec, VIDEO_FRAME * current)
+{
+  GstFlowReturn result = _gst_libde265_dec_drain_context (dec, current);
+  if (result != GST_FLOW_OK) {
+    return result;
+  }
+
+  GST_DEBUG_OBJECT (dec, "Resizing worker threads at IRAP picture");
+  _gst_libde265_dec_release_context (dec);
+  if (!_gst_libde265_dec_create_context (dec)) {
+    GST_ELEMENT_ERROR (dec, LIBRARY, INIT,
+        ("Failed to create decoder context"), (NULL));
+    return GST_FLOW_ERROR;
+  }
+  // the pictures of the old context can't be referenced
+  dec->no_rasl_output = TRUE;
+  if (!_gst_libde265_dec_restore_param_sets (dec)) {
+    return GST_FLOW_ERROR;
+  }
+  return GST_FLOW_OK;
+}
+
+static GstFlowReturn
+_gst_libde265_dec_decode_frame (VIDEO_DECODER_BASE * parse, VIDEO_FRAME * frame)
+{
+  GstLibde265Dec *dec = GST_LIBDE265_DEC (parse);
+  gint64 start = g_get_monotonic_time ();
+  uint8_t *frame_data;
+  uint8_t *end_data;
+  const struct de265_image *img;
+  de265_error ret = DE265_OK;
+  int more = 0;
+  de265_PTS pts = (de265_PTS) FRAME_PTS (frame);
+  gsize size;
+
+#if GST_CHECK_VERSION(1,0,0)
+  GstMapInfo info;
+  if (!gst_buffer_map (frame->input_buffer, &info, GST_MAP_READ)) {
+    GST_ERROR_OBJECT (dec, "Failed to map input buffer");
+    return GST_FLOW_ERROR;
+  }
+
+  frame_data = info.data;
+  size = info.size;
+#else
+  frame_data = GST_BUFFER_DATA (frame->sink_buffer);
+  size = GST_BUFFER_SIZE (frame->sink_buffer);
+#endif
+  end_data = frame_data + size;
+
+#if GST_CHECK_VERSION(1,0,0)
+  _gst_libde265_dec_mark_decode_only (frame);
+  _gst_libde265_dec_update_qos (dec, frame);
+  gboolean clipped = _gst_libde265_dec_is_clipped (dec, FRAME_PTS (frame),
+      FRAME_DURATION (frame));
+#else
+  gboolean clipped = FALSE;
+#endif
+  if (size > 0) {
+    if (dec->mode == GST_TYPE_LIBDE265_DEC_PACKETIZED || dec->au_input) {
+      // stream contains length fields and NALs, or start codes and the
+      // NALs of one access unit
+      const guint8 *start_data = frame_data;
+      const guint8 *nal;
+      gsize nal_size;
+      gsize payload = 0;
+      gsize batch_size = 0;
+      int found;
+      int nals = 0;
+      int first_type = -1;
+      int decoded_slices = 0;
+      int skipped_slices = 0;
+      gboolean skipped_by_qos = FALSE;
+      // validate all length fields before anything is passed on
+      while ((found = _gst_libde265_dec_next_nal (dec, &start_data, end_data,
+                  &nal, &nal_size)) > 0) {
+        payload += nal_size;
+        nals++;
+        // parameter sets of the access unit are known before its IRAP
+        // picture is decoded
+        _gst_libde265_dec_inspect_nal (dec, nal, nal_size);
+        if (nal_size >= 2) {
+          int type = GST_LIBDE265_NAL_TYPE (nal);
+          if (first_type < 0 && GST_LIBDE265_NAL_IS_VCL (type)) {
+            first_type = type;
+          } else if (type >= GST_LIBDE265_NAL_VPS
+              && type <= GST_LIBDE265_NAL_PPS) {
+            _gst_libde265_dec_remember_param_set (dec, nal, nal_size);
+          }
+        }
+      }
+      if (found < 0) {
+        GST_ELEMENT_ERROR (parse, STREAM, DECODE,
+            ("Overflow in input data, check data mode"), (NULL));
+        goto error_input;
+      }
+      if (GST_LIBDE265_NAL_IS_IRAP (first_type)
+          && _gst_libde265_dec_context_outdated (dec)) {
+        GstFlowReturn result = _gst_libde265_dec_renew_context (dec, frame);
+        if (result != GST_FLOW_OK) {
+#if GST_CHECK_VERSION(1,0,0)
+          gst_buffer_unmap (frame->input_buffer, &info);
+#endif
+          return result;
+        }
+      }
+      // every call to de265_push_NAL has a fixed cost, many small NAL
+      // units may be cheaper to pass as one block with start codes. The
+      // block is copied and parsed for start codes, so this is only done
+      // if enabled, examples/timenal measures both ways.
+      gboolean batch = dec->batch_nal_units && nals >= BATCH_MIN_NALS
+          && payload <= (gsize) nals * BATCH_MAX_NAL_SIZE;
+      if (batch && dec->nal_arena_size < payload + 3 * nals) {
+        dec->nal_arena_size = payload + 3 * nals;
+        dec->nal_arena = g_realloc (dec->nal_arena, dec->nal_arena_size);
+      }
+      start_data = frame_data;
+      while (_gst_libde265_dec_next_nal (dec, &start_data, end_data, &nal,
+              &nal_size) > 0) {
+        if (_gst_libde265_dec_skip_nal (dec, nal, nal_size, clipped,
+                &skipped_by_qos)) {
+          skipped_slices++;
+          continue;
+        }
+        if (nal_size >= 2
+            && GST_LIBDE265_NAL_IS_VCL (GST_LIBDE265_NAL_TYPE (nal))) {
+          decoded_slices++;
+        }
+        if (batch) {
+          guint8 *out = dec->nal_arena + batch_size;
+          out[0] = 0;
+          out[1] = 0;
+          out[2] = 1;
+          memcpy (out + 3, nal, nal_size);
+          batch_size += 3 + nal_size;
+          dec->batched_nals++;
+          continue;
+        }
+        ret = de265_push_NAL (dec->ctx, nal, nal_size, pts, NULL);
+        if (ret != DE265_OK) {
+          GST_ELEMENT_ERROR (parse, STREAM, DECODE,
+              ("Error while pushing data: %s (code=%d)",
+                  de265_get_error_text (ret), ret), (NULL));
+          goto error_input;
+        }
+      }
+      if (batch_size > 0) {
+        ret = de265_push_data (dec->ctx, dec->nal_arena, batch_size, pts,
+            NULL);
+        if (ret != DE265_OK) {
+          GST_ELEMENT_ERROR (parse, STREAM, DECODE,
+              ("Error while pushing data: %s (code=%d)",
+                  de265_get_error_text (ret), ret), (NULL));
+          goto error_input;
+        }
+        // the last NAL unit is complete, it must not wait for the next
+        // start code
+        de265_push_end_of_NAL (dec->ctx);
+      }
+#if GST_CHECK_VERSION(1,0,0)
+      if (skipped_slices > 0 && decoded_slices == 0) {
+        // the picture will never be output
+        gst_buffer_unmap (frame->input_buffer, &info);
+        GST_LOG_OBJECT (dec, "Skipped decoding of frame %d",
+            frame->system_frame_number);
+#if GST_CHECK_VERSION(1,2,2)
+        if (!skipped_by_qos) {
+          // not a QoS event, the sub-layer was never meant to be output
+          gst_video_decoder_release_frame (parse, frame);
+          return GST_FLOW_OK;
+        }
+#endif
+        // this also posts a QoS message
+        return gst_video_decoder_drop_frame (parse, frame);
+      }
+      if (dec->low_latency) {
+        // the input frame contains the whole access unit
+        de265_push_end_of_frame (dec->ctx);
+      }
+#endif
+    } else {
+      // temporal sub-layers are skipped by the decoder in this mode
+      _gst_libde265_dec_inspect_data (dec, frame_data, size);
+      _gst_libde265_dec_update_tid (dec, -1, 0);
+      ret = _gst_libde265_dec_push_raw (dec, frame_data, size, pts);
+      if (ret != DE265_OK) {
+        GST_ELEMENT_ERROR (parse, STREAM, DECODE,
+            ("Error while pushing data: %s (code=%d)",
+                de265_get_error_text (ret), ret), (NULL));
+        goto error_input;
+      }
+    }
+  } else {
+    ret = de265_flush_data (dec->ctx);
+    if (ret != DE265_OK) {
+      GST_ELEMENT_ERROR (parse, STREAM, DECODE,
+          ("Error while flushing data: %s (code=%d)",
+              de265_get_error_text (ret), ret), (NULL));
+      goto error_input;
+    }
+  }
+#if GST_CHECK_VERSION(1,0,0)
+  gst_buffer_unmap (frame->input_buffer, &info);
+#endif
+  gint64 pushed = g_get_monotonic_time ();
+  dec->push_time += pushed - start;
+
+  // decode as much as possible
+#if GST_CHECK_VERSION(1,0,0)
+  dec->frame_number = frame->system_frame_number;
+#endif
+  do {
+    ret = de265_decode (dec->ctx, &more);
+  } while (more && ret == DE265_OK);
+  dec->decode_time += g_get_monotonic_time () - pushed;
+  dec->pending_nals = de265_get_number_of_NAL_units_pending (dec->ctx);
+
+  switch (ret) {
+    case DE265_OK:
+    case DE265_ERROR_WAITING_FOR_INPUT_DATA:
+      break;
+
+    case DE265_ERROR_IMAGE_BUFFER_FULL:
+      dec->buffer_full = 1;
+      dec->buffer_full_events++;
+      if ((img = de265_peek_next_picture (dec->ctx)) == NULL) {
+        return GST_FLOW_OK;
+      }
+      break;
+
+    default:
+      GST_ELEMENT_ERROR (parse, STREAM, DECODE,
+          ("Error while decoding: %s (code=%d)", de265_get_error_text (ret),
+              ret), (NULL));
+      return GST_FLOW_ERROR;
+  }
+
+  while ((ret = de265_get_warning (dec->ctx)) != DE265_OK) {
+    GST_ELEMENT_WARNING (parse, STREAM, DECODE,
+        ("%s (code=%d)", de265_get_error_text (ret), ret), (NULL));
+  }
+
+#if GST_CHECK_VERSION(1,0,0)
+  if (dec->low_latency) {
+    // don't wait for further input frames to output the direct rendered
+    // pictures that are ready, one is left for the code below
+    while ((img = de265_peek_next_picture (dec->ctx)) != NULL
+        && _gst_libde265_dec_is_direct (img)) {
+      img = de265_get_next_picture (dec->ctx);
+      if (de265_peek_next_picture (dec->ctx) == NULL) {
+        gst_video_codec_frame_unref (frame);
+        return _gst_libde265_dec_finish_direct (parse, img);
+      }
+      GstFlowReturn result = _gst_libde265_dec_finish_direct (parse, img);
+      if (result != GST_FLOW_OK) {
+        gst_video_codec_frame_unref (frame);
+        return result;
+      }
+    }
+  }
+#endif
+
+  img = de265_get_next_picture (dec->ctx);
+  if (img == NULL) {
+    // need more data
+    return GST_FLOW_OK;
+  }
+  return _gst_libde265_dec_output_picture (parse, frame, img);
+
+error_input:
+#if GST_CHECK_VERSION(1,0,0)
+  gst_buffer_unmap (frame->input_buffer, &info);
+#endif
+  return GST_FLOW_ERROR;
+}
+
+#if GST_CHECK_VERSION(1,0,0)
+/*
+ * GOP-parallel decoding: the input is split into GOPs that start at IRAP
+ * pictures and don't reference pictures of earlier GOPs. Each GOP is
+ * decoded by one of several worker threads with its own decoder context,
+ * the streaming thread finishes the pictures of the GOPs in their order.
+ * Only the newest GOP receives input, all older ones can be decoded to
+ * their end.
+ */
+
+// a worker waits while the pictures of its GOP that were not finished yet
+// exceed the output limit, the streaming thread while the input of the
+// newest GOP exceeds the input limit
+#define GOP_MAX_INPUT_FRAMES        64
+#define GOP_MAX_OUTPUT_SIZE         (64 * 1024 * 1024)
+
+struct GstLibde265GopWorker
+{
+  GstLibde265Dec *dec;
+  de265_decoder_context *ctx;
+  GThread *thread;
+};
+
+struct GstLibde265GopInput
+{
+  GByteArray *data;
+  de265_PTS pts;
+};
+
+struct GstLibde265GopPicture
+{
+  GstBuffer *buffer;
+  GstVideoFormat format;
+  int width;
+  int height;
+  de265_PTS pts;
+};
+
+struct GstLibde265Gop
+{
+  // parameter sets seen before the GOP, passed to the decoder first
+  GByteArray *param_sets;
+  // chosen by the streaming thread, workers can't query downstream
+  GstVideoFormat planar_format;
+  GstVideoFormat output_format;
+  int scale;
+  // input frames in decoding order, only used by the streaming thread
+  GQueue frames;
+  // protected by the GOP lock
+  GQueue input;
+  GQueue output;
+  gsize output_size;
+  // number of frames, only used by the streaming thread
+  int length;
+  // the worker waits for caps with this picture format and size
+  gboolean negotiate;
+  GstVideoFormat negotiate_format;
+  int negotiate_width;
+  int negotiate_height;
+  gboolean complete;
+  gboolean done;
+  gboolean discard;
+  GstFlowReturn flow;
+};
+
+typedef enum
+{
+  GOP_WAIT_NONE,                // only finish the pictures that are ready
+  GOP_WAIT_SLOT,                // until another GOP can be started
+  GOP_WAIT_INPUT,               // until the newest GOP takes more input
+  GOP_WAIT_ALL                  // until all GOPs are finished
+} GstLibde265GopWait;
+
+static struct GstLibde265Gop *
+_gst_libde265_dec_gop_new (GstLibde265Dec * dec)
+{
+  static const guint8 start_code[] = { 0, 0, 1 };
+  struct GstLibde265Gop *gop = g_new0 (struct GstLibde265Gop, 1);
+  GList *walk;
+
+  gop->param_sets = g_byte_array_new ();
+  if (dec->param_sets != NULL) {
+    g_byte_array_append (gop->param_sets, dec->param_sets->nals->data,
+        dec->param_sets->nals->len);
+  }
+  for (walk = dec->param_history.head; walk != NULL; walk = walk->next) {
+    gsize size;
+    const guint8 *nal = g_bytes_get_data ((GBytes *) walk->data, &size);
+    g_byte_array_append (gop->param_sets, start_code, sizeof (start_code));
+    g_byte_array_append (gop->param_sets, nal, size);
+  }
+
+  gop->planar_format = GST_VIDEO_FORMAT_UNKNOWN;
+  gop->output_format = GST_VIDEO_FORMAT_UNKNOWN;
+  if (dec->have_sps) {
+    gop->planar_format =
+        _gst_libde265_get_video_format ((enum de265_chroma)
+        dec->sps.chroma_format_idc, MAX (dec->sps.bit_depth_luma,
+            dec->sps.bit_depth_chroma));
+    if (gop->planar_format != GST_VIDEO_FORMAT_UNKNOWN) {
+      gop->output_format =
+          _gst_libde265_dec_output_format (dec, gop->planar_format);
+    }
+  }
+  gop->scale = dec->output_scale;
+  gop->flow = GST_FLOW_OK;
+  return gop;
+}
+
+static void
+_gst_libde265_dec_gop_free (struct GstLibde265Gop *gop)
+{
+  struct GstLibde265GopInput *input;
+  struct GstLibde265GopPicture *picture;
+  VIDEO_FRAME *frame;
+
+  while ((input = g_queue_pop_head (&gop->input)) != NULL) {
+    g_byte_array_unref (input->data);
+    g_slice_free (struct GstLibde265GopInput, input);
+  }
+  while ((picture = g_queue_pop_head (&gop->output)) != NULL) {
+    gst_buffer_unref (picture->buffer);
+    g_slice_free (struct GstLibde265GopPicture, picture);
+  }
+  while ((frame = g_queue_pop_head (&gop->frames)) != NULL) {
+    gst_video_codec_frame_unref (frame);
+  }
+  g_byte_array_unref (gop->param_sets);
+  g_free (gop);
+}
+
+/*
+ * Remember the first failure of a worker. Workers can't return a flow to
+ * upstream, the streaming thread posts the error and returns the flow from
+ * the next call to _gst_libde265_dec_gop_drain. Takes the message.
+ */
+static GstFlowReturn
+_gst_libde265_dec_gop_fail (GstLibde265Dec * dec, GstFlowReturn flow,
+    gchar * message)
+{
+  g_mutex_lock (&dec->gop_lock);
+  if (dec->gop_flow == GST_FLOW_OK) {
+    dec->gop_flow = flow;
+    dec->gop_error = message;
+    message = NULL;
+  }
+  g_cond_broadcast (&dec->gop_cond);
+  g_mutex_unlock (&dec->gop_lock);
+  g_free (message);
+  return flow;
+}
+
+// must be called with the GOP lock held
+static inline gboolean
+_gst_libde265_dec_gop_pool_matches (GstLibde265Dec * dec,
+    GstBufferPool * failed, GstVideoFormat format, int width, int height)
+{
+  return dec->gop_pool != NULL && dec->gop_pool != failed
+      && GST_VIDEO_INFO_FORMAT (&dec->gop_info) == format
+      && GST_VIDEO_INFO_WIDTH (&dec->gop_info) == width
+      && GST_VIDEO_INFO_HEIGHT (&dec->gop_info) == height;
+}
+
+/*
+ * Make the buffer pool of the current output state available to the
+ * workers, must be called by the streaming thread after negotiating.
+ */
+static void
+_gst_libde265_dec_gop_publish (GstLibde265Dec * dec)
+{
+  GstBufferPool *pool =
+      gst_video_decoder_get_buffer_pool (GST_VIDEO_DECODER (dec));
+  GstVideoInfo info = dec->gop_info;
+
+  if (dec->output_state != NULL) {
+    info = dec->output_state->info;
+  }
+  g_mutex_lock (&dec->gop_lock);
+  if (pool != dec->gop_pool || dec->use_crop_meta != dec->gop_crop_meta
+      || GST_VIDEO_INFO_FORMAT (&info) != GST_VIDEO_INFO_FORMAT (&dec->gop_info)
+      || GST_VIDEO_INFO_WIDTH (&info) != GST_VIDEO_INFO_WIDTH (&dec->gop_info)
+      || GST_VIDEO_INFO_HEIGHT (&info) !=
+      GST_VIDEO_INFO_HEIGHT (&dec->gop_info)) {
+    gst_object_replace ((GstObject **) & dec->gop_pool, (GstObject *) pool);
+    dec->gop_info = info;
+    dec->gop_crop_meta = dec->use_crop_meta;
+    g_cond_broadcast (&dec->gop_cond);
+  }
+  g_mutex_unlock (&dec->gop_lock);
+  if (pool != NULL) {
+    gst_object_unref (pool);
+  }
+}
+
+/*
+ * Take an output buffer for a picture from the negotiated pool, called by
+ * the workers. Caps are only negotiated by the streaming thread, and only
+ * once the pictures of all earlier GOPs are finished, so a worker waits if
+ * its picture doesn't match them.
+ */
+static GstFlowReturn
+_gst_libde265_dec_gop_acquire (GstLibde265Dec * dec,
+    struct GstLibde265Gop *gop, GstVideoFormat format, int width,
+    int height, GstBuffer ** buffer, GstVideoInfo * info)
+{
+  GstBufferPool *failed = NULL;
+  GstFlowReturn ret = GST_FLOW_OK;
+  gboolean retried = FALSE;
+
+  *buffer = NULL;
+  g_mutex_lock (&dec->gop_lock);
+  while (*buffer == NULL) {
+    if (gop->discard || dec->gop_quit) {
+      ret = GST_FLOW_FLUSHING;
+      break;
+    }
+    gboolean matches = _gst_libde265_dec_gop_pool_matches (dec, failed,
+        format, width, height);
+    if (gop->negotiate) {
+      if (matches) {
+        gop->negotiate = FALSE;
+      } else {
+        g_cond_wait (&dec->gop_cond, &dec->gop_lock);
+      }
+      continue;
+    }
+    if (!matches) {
+      if (failed != NULL && failed == dec->gop_pool && retried) {
+        // negotiating again didn't give a new pool
+        break;
+      }
+      gop->negotiate = TRUE;
+      gop->negotiate_format = format;
+      gop->negotiate_width = width;
+      gop->negotiate_height = height;
+      retried = failed != NULL;
+      g_cond_broadcast (&dec->gop_cond);
+      continue;
+    }
+
+    GstBufferPool *pool = gst_object_ref (dec->gop_pool);
+    gboolean crop_meta = dec->gop_crop_meta;
+    *info = dec->gop_info;
+    g_mutex_unlock (&dec->gop_lock);
+    ret = gst_buffer_pool_acquire_buffer (pool, buffer, NULL);
+    if (ret == GST_FLOW_OK && crop_meta) {
+      // buffers have the coded size, the picture is copied to the top left
+      _gst_libde265_dec_set_crop (*buffer, 0, 0, width, height);
+    }
+    g_mutex_lock (&dec->gop_lock);
+    if (ret != GST_FLOW_OK) {
+      // the pool may have been replaced by a renegotiation meanwhile
+      GST_DEBUG_OBJECT (dec, "Failed to acquire buffer: %s",
+          gst_flow_get_name (ret));
+      gst_object_replace ((GstObject **) & failed, (GstObject *) pool);
+      retried = FALSE;
+      *buffer = NULL;
+    }
+    gst_object_unref (pool);
+  }
+  g_mutex_unlock (&dec->gop_lock);
+  if (failed != NULL) {
+    gst_object_unref (failed);
+  }
+  return ret;
+}
+
+// copy a decoded picture to a buffer of the output pool, called by the
+// workers
+static GstFlowReturn
+_gst_libde265_dec_gop_convert (GstLibde265Dec * dec,
+    struct GstLibde265Gop *gop, const struct de265_image *img,
+    struct GstLibde265GopPicture **picture)
+{
+  int bits_per_pixel = MAX (MAX (de265_get_bits_per_pixel (img, 0),
+          de265_get_bits_per_pixel (img, 1)), de265_get_bits_per_pixel (img,
+          2));
+  GstVideoFormat format =
+      _gst_libde265_get_video_format (de265_get_chroma_format (img),
+      bits_per_pixel);
+  if (format == GST_VIDEO_FORMAT_UNKNOWN) {
+    return _gst_libde265_dec_gop_fail (dec, GST_FLOW_ERROR,
+        g_strdup ("Unsupported image format"));
+  }
+  if (format == gop->planar_format) {
+    format = gop->output_format;
+  }
+
+  int width = MAX (1, de265_get_image_width (img, 0) / gop->scale);
+  int height = MAX (1, de265_get_image_height (img, 0) / gop->scale);
+  GstBuffer *buffer;
+  GstVideoInfo info;
+  GstFlowReturn ret = _gst_libde265_dec_gop_acquire (dec, gop, format,
+      width, height, &buffer, &info);
+  if (ret != GST_FLOW_OK) {
+    // flushing is no error, e.g. while the GOPs are discarded
+    return _gst_libde265_dec_gop_fail (dec, ret,
+        ret == GST_FLOW_FLUSHING ? NULL :
+        g_strdup_printf ("Failed to allocate output buffer: %s",
+            gst_flow_get_name (ret)));
+  }
+
+  GstVideoFrame vframe;
+  if (!gst_video_frame_map (&vframe, &info, buffer, GST_MAP_WRITE)) {
+    gst_buffer_unref (buffer);
+    return _gst_libde265_dec_gop_fail (dec, GST_FLOW_ERROR,
+        g_strdup ("Failed to map output buffer"));
+  }
+
+  GstLibde265CopyPlane copy[3];
+  int planes = GST_VIDEO_FRAME_N_PLANES (&vframe);
+  int plane;
+  for (plane = 0; plane < planes; plane++) {
+    _gst_libde265_dec_copy_source (&copy[plane], img, plane,
+        _gst_libde265_dec_sample_bits (format));
+    _gst_libde265_dec_copy_dest (&copy[plane], img, &vframe, plane,
+        gop->scale);
+  }
+  gst_libde265_copy_planes (copy, planes, gop->scale);
+  gst_video_frame_unmap (&vframe);
+
+  *picture = g_slice_new (struct GstLibde265GopPicture);
+  (*picture)->buffer = buffer;
+  (*picture)->format = format;
+  (*picture)->width = width;
+  (*picture)->height = height;
+  (*picture)->pts = de265_get_image_PTS (img);
+  return GST_FLOW_OK;
+}
+
+// decode the data pushed so far and add the pictures to the GOP
+static GstFlowReturn
+_gst_libde265_dec_gop_run (GstLibde265Dec * dec, de265_decoder_context * ctx,
+    struct GstLibde265Gop *gop)
+{
+  const struct de265_image *img;
+  de265_error ret;
+  int more;
+
+  do {
+    ret = de265_decode (ctx, &more);
+    while ((img = de265_get_next_picture (ctx)) != NULL) {
+      struct GstLibde265GopPicture *picture;
+      GstFlowReturn flow =
+          _gst_libde265_dec_gop_convert (dec, gop, img, &picture);
+      if (flow != GST_FLOW_OK) {
+        return flow;
+      }
+      g_mutex_lock (&dec->gop_lock);
+      g_queue_push_tail (&gop->output, picture);
+      gop->output_size += gst_buffer_get_size (picture->buffer);
+      g_cond_broadcast (&dec->gop_cond);
+      g_mutex_unlock (&dec->gop_lock);
+    }
+  } while (more && (ret == DE265_OK || ret == DE265_ERROR_IMAGE_BUFFER_FULL));
+
+  switch (ret) {
+    case DE265_OK:
+    case DE265_ERROR_WAITING_FOR_INPUT_DATA:
+    case DE265_ERROR_IMAGE_BUFFER_FULL:
+      break;
+
+    default:
+      return _gst_libde265_dec_gop_fail (dec, GST_FLOW_ERROR,
+          g_strdup_printf ("Error while decoding: %s (code=%d)",
+              de265_get_error_text (ret), ret));
   }
 
-  GST_VIDEO_CODEC_FRAME_FLAG_UNSET (frame,
-      GST_VIDEO_CODEC_FRAME_FLAG_DECODE_ONLY);
-#endif
+  while ((ret = de265_get_warning (ctx)) != DE265_OK) {
+    GST_ELEMENT_WARNING (dec, STREAM, DECODE,
+        ("%s (code=%d)", de265_get_error_text (ret), ret), (NULL));
+  }
+  return GST_FLOW_OK;
+}
 
-  int bits_per_pixel = MAX (MAX (de265_get_bits_per_pixel (img, 0),
-          de265_get_bits_per_pixel (img, 1)), de265_get_bits_per_pixel (img,
-          2));
+// decode a GOP as its input arrives, called with the GOP lock held
+static void
+_gst_libde265_dec_gop_decode (GstLibde265Dec * dec,
+    de265_decoder_context * ctx, struct GstLibde265Gop *gop)
+{
+  GstFlowReturn flow = GST_FLOW_OK;
+  de265_error ret;
+  gboolean flushed = FALSE;
 
-  GstVideoFormat format =
-      _gst_libde265_get_video_format (de265_get_chroma_format (img),
-      bits_per_pixel);
-  if (format == GST_VIDEO_FORMAT_UNKNOWN) {
-    GST_ERROR_OBJECT (dec, "Unsupported image format");
-    return GST_FLOW_ERROR;
+  g_mutex_unlock (&dec->gop_lock);
+  de265_reset (ctx);
+  ret = de265_push_data (ctx, gop->param_sets->data, gop->param_sets->len, 0,
+      NULL);
+  de265_push_end_of_NAL (ctx);
+  g_mutex_lock (&dec->gop_lock);
+
+  while (de265_isOK (ret) && flow == GST_FLOW_OK && !flushed
+      && !gop->discard) {
+    // the streaming thread finishes the pictures of older GOPs meanwhile
+    if ((g_queue_is_empty (&gop->input) && !gop->complete)
+        || gop->output_size >= GOP_MAX_OUTPUT_SIZE) {
+      g_cond_wait (&dec->gop_cond, &dec->gop_lock);
+      continue;
+    }
+
+    struct GstLibde265GopInput *input = g_queue_pop_head (&gop->input);
+    g_cond_broadcast (&dec->gop_cond);
+    g_mutex_unlock (&dec->gop_lock);
+    if (input != NULL) {
+      ret = de265_push_data (ctx, input->data->data, input->data->len,
+          input->pts, NULL);
+      // the input of a frame ends with a complete NAL unit
+      de265_push_end_of_NAL (ctx);
+      g_byte_array_unref (input->data);
+      g_slice_free (struct GstLibde265GopInput, input);
+    } else {
+      ret = de265_flush_data (ctx);
+      flushed = TRUE;
+    }
+    if (de265_isOK (ret)) {
+      flow = _gst_libde265_dec_gop_run (dec, ctx, gop);
+    }
+    g_mutex_lock (&dec->gop_lock);
   }
 
-  GstFlowReturn result =
-      _gst_libde265_image_available (parse, de265_get_image_width (img, 0),
-      de265_get_image_height (img, 0), format);
-  if (result != GST_FLOW_OK) {
-    GST_ERROR_OBJECT (dec, "Failed to notify about available image");
-    return result;
+  if (!de265_isOK (ret)) {
+    g_mutex_unlock (&dec->gop_lock);
+    flow = _gst_libde265_dec_gop_fail (dec, GST_FLOW_ERROR,
+        g_strdup_printf ("Error while pushing data: %s (code=%d)",
+            de265_get_error_text (ret), ret));
+    g_mutex_lock (&dec->gop_lock);
   }
+  gop->flow = flow;
+  gop->done = TRUE;
+  g_cond_broadcast (&dec->gop_cond);
+}
 
-  result = ALLOC_OUTPUT_FRAME (parse, frame);
-  if (result != GST_FLOW_OK) {
-    GST_ERROR_OBJECT (dec, "Failed to allocate output frame");
-    return result;
+static gpointer
+_gst_libde265_dec_gop_loop (gpointer data)
+{
+  struct GstLibde265GopWorker *worker = (struct GstLibde265GopWorker *) data;
+  GstLibde265Dec *dec = worker->dec;
+
+  g_mutex_lock (&dec->gop_lock);
+  while (TRUE) {
+    while (g_queue_is_empty (&dec->gop_queue) && !dec->gop_quit) {
+      g_cond_wait (&dec->gop_cond, &dec->gop_lock);
+    }
+    if (dec->gop_quit) {
+      break;
+    }
+    _gst_libde265_dec_gop_decode (dec, worker->ctx,
+        g_queue_pop_head (&dec->gop_queue));
   }
+  g_mutex_unlock (&dec->gop_lock);
+  return NULL;
+}
 
-  uint8_t *dest;
-#if GST_CHECK_VERSION(1,0,0)
-  if (!gst_buffer_map (frame->output_buffer, &info, GST_MAP_WRITE)) {
-    GST_ERROR_OBJECT (dec, "Failed to map output buffer");
-    return GST_FLOW_ERROR;
+// finish the next input frame of a GOP with a picture
+static GstFlowReturn
+_gst_libde265_dec_gop_finish (GstLibde265Dec * dec,
+    struct GstLibde265Gop *gop, struct GstLibde265GopPicture *picture)
+{
+  VIDEO_DECODER_BASE *parse = GST_VIDEO_DECODER (dec);
+  VIDEO_FRAME *frame = g_queue_pop_head (&gop->frames);
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  if (frame != NULL) {
+    ret = _gst_libde265_image_available (parse, picture->width,
+        picture->height, NULL, picture->format);
+    if (ret == GST_FLOW_OK) {
+      if (!_gst_libde265_dec_upstream_decode_only (frame)) {
+        GST_VIDEO_CODEC_FRAME_FLAG_UNSET (frame,
+            GST_VIDEO_CODEC_FRAME_FLAG_DECODE_ONLY);
+      }
+      gst_buffer_replace (&frame->output_buffer, picture->buffer);
+      ret = _gst_libde265_dec_finish_frame (parse, frame, picture->pts);
+      // finishing renegotiates if downstream asked for it
+      _gst_libde265_dec_gop_publish (dec);
+    } else {
+      GST_ERROR_OBJECT (dec, "Failed to notify about available image");
+      gst_video_codec_frame_unref (frame);
+    }
   }
+  gst_buffer_unref (picture->buffer);
+  g_slice_free (struct GstLibde265GopPicture, picture);
+  return ret;
+}
 
-  dest = info.data;
-#else
-  dest = GST_BUFFER_DATA (frame->src_buffer);
-#endif
+// release the frames of a decoded GOP that got no picture
+static GstFlowReturn
+_gst_libde265_dec_gop_release (GstLibde265Dec * dec,
+    struct GstLibde265Gop *gop)
+{
+  GstFlowReturn ret = gop->flow;
+  VIDEO_FRAME *frame;
 
-#if GST_CHECK_VERSION(1,0,0)
-  const GstVideoFormatInfo *format_info = gst_video_format_get_info (format);
-  int max_bits_per_pixel = GST_VIDEO_FORMAT_INFO_BITS (format_info);
+  while ((frame = g_queue_pop_head (&gop->frames)) != NULL) {
+#if GST_CHECK_VERSION(1,2,2)
+    gst_video_decoder_release_frame (GST_VIDEO_DECODER (dec), frame);
 #else
-  int max_bits_per_pixel = 8;
+    gst_video_decoder_drop_frame (GST_VIDEO_DECODER (dec), frame);
 #endif
+  }
+  _gst_libde265_dec_gop_free (gop);
+  return ret;
+}
 
-  int plane;
-  for (plane = 0; plane < 3; plane++) {
-    int stride;
-    int pos;
-    int width = de265_get_image_width (img, plane);
-    int height = de265_get_image_height (img, plane);
-    const uint8_t *src = de265_get_image_plane (img, plane, &stride);
-    int dst_stride = width * ((max_bits_per_pixel + 7) / 8);
-    int plane_bits_per_pixel = de265_get_bits_per_pixel (img, plane);
-    if (plane_bits_per_pixel > max_bits_per_pixel && max_bits_per_pixel > 8) {
-      // More bits per pixel in this plane than supported by the output format
-      int shift = (plane_bits_per_pixel - max_bits_per_pixel);
-      int size = MIN (stride, dst_stride);
-      while (height--) {
-        uint16_t *s = (uint16_t *) src;
-        uint16_t *d = (uint16_t *) dest;
-        for (pos = 0; pos < size / 2; pos++) {
-          *d = *s >> shift;
-          d++;
-          s++;
-        }
-        src += stride;
-        dest += dst_stride;
-      }
-    } else if (plane_bits_per_pixel > max_bits_per_pixel
-        && max_bits_per_pixel == 8) {
-      // More bits per pixel in this plane than supported by the output format
-      int shift = (plane_bits_per_pixel - max_bits_per_pixel);
-      int size = MIN (stride, dst_stride);
-      while (height--) {
-        uint16_t *s = (uint16_t *) src;
-        uint8_t *d = (uint8_t *) dest;
-        for (pos = 0; pos < size; pos++) {
-          *d = *s >> shift;
-          d++;
-          s++;
-        }
-        src += stride;
-        dest += dst_stride;
-      }
-    } else if (plane_bits_per_pixel < max_bits_per_pixel
-        && plane_bits_per_pixel > 8) {
-      // Less bits per pixel in this plane than the rest of the picture
-      // but more than 8bpp.
-      int shift = (plane_bits_per_pixel - max_bits_per_pixel);
-      int size = MIN (stride, dst_stride);
-      while (height--) {
-        uint16_t *s = (uint16_t *) src;
-        uint16_t *d = (uint16_t *) dest;
-        for (pos = 0; pos < size / 2; pos++) {
-          *d = *s >> shift;
-          d++;
-          s++;
-        }
-        src += stride;
-        dest += dst_stride;
+// must be called with the GOP lock held
+static gboolean
+_gst_libde265_dec_gop_waiting (GstLibde265Dec * dec, GstLibde265GopWait until)
+{
+  struct GstLibde265Gop *newest = g_queue_peek_tail (&dec->gops);
+
+  switch (until) {
+    case GOP_WAIT_SLOT:
+      return dec->gops.length >= _gst_libde265_dec_gops_in_flight (dec);
+    case GOP_WAIT_INPUT:
+      return newest != NULL && newest->input.length >= GOP_MAX_INPUT_FRAMES;
+    case GOP_WAIT_ALL:
+      return !g_queue_is_empty (&dec->gops);
+    default:
+      return FALSE;
+  }
+}
+
+/*
+ * Finish the pictures of the oldest GOPs in order until the condition is
+ * met, must be called with the stream lock held. The oldest GOP always
+ * has a worker, so it can't block on the ones after it.
+ */
+static GstFlowReturn
+_gst_libde265_dec_gop_drain (GstLibde265Dec * dec, GstLibde265GopWait until)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  g_mutex_lock (&dec->gop_lock);
+  while (ret == GST_FLOW_OK) {
+    struct GstLibde265Gop *oldest = g_queue_peek_head (&dec->gops);
+    struct GstLibde265GopPicture *picture = NULL;
+    if (dec->gop_flow != GST_FLOW_OK) {
+      // a worker failed, the error is only posted once
+      gchar *message = dec->gop_error;
+      dec->gop_error = NULL;
+      ret = dec->gop_flow;
+      if (message != NULL) {
+        g_mutex_unlock (&dec->gop_lock);
+        GST_ELEMENT_ERROR (dec, STREAM, DECODE, ("%s", message), (NULL));
+        g_free (message);
+        g_mutex_lock (&dec->gop_lock);
       }
-    } else if (plane_bits_per_pixel < max_bits_per_pixel
-        && plane_bits_per_pixel == 8) {
-      // 8 bits per pixel in this plane, which is less than the rest of the picture.
-      int shift = (max_bits_per_pixel - plane_bits_per_pixel);
-      int size = MIN (stride, dst_stride);
-      while (height--) {
-        uint8_t *s = (uint8_t *) src;
-        uint16_t *d = (uint16_t *) dest;
-        for (pos = 0; pos < size; pos++) {
-          *d = *s << shift;
-          d++;
-          s++;
-        }
-        src += stride;
-        dest += dst_stride;
+      break;
+    }
+    if (oldest != NULL && oldest->negotiate
+        && g_queue_is_empty (&oldest->output)) {
+      // all pictures with the current caps are finished
+      g_mutex_unlock (&dec->gop_lock);
+      ret = _gst_libde265_image_available (GST_VIDEO_DECODER (dec),
+          oldest->negotiate_width, oldest->negotiate_height, NULL,
+          oldest->negotiate_format);
+      _gst_libde265_dec_gop_publish (dec);
+      g_mutex_lock (&dec->gop_lock);
+      oldest->negotiate = FALSE;
+      g_cond_broadcast (&dec->gop_cond);
+      if (ret != GST_FLOW_OK) {
+        GST_ERROR_OBJECT (dec, "Failed to notify about available image");
       }
+      continue;
+    }
+    if (oldest != NULL) {
+      picture = g_queue_pop_head (&oldest->output);
+    }
+    if (picture != NULL) {
+      oldest->output_size -= gst_buffer_get_size (picture->buffer);
+      g_cond_broadcast (&dec->gop_cond);
+      g_mutex_unlock (&dec->gop_lock);
+      ret = _gst_libde265_dec_gop_finish (dec, oldest, picture);
+      g_mutex_lock (&dec->gop_lock);
+    } else if (oldest != NULL && oldest->done) {
+      g_queue_pop_head (&dec->gops);
+      g_mutex_unlock (&dec->gop_lock);
+      ret = _gst_libde265_dec_gop_release (dec, oldest);
+      g_mutex_lock (&dec->gop_lock);
+    } else if (_gst_libde265_dec_gop_waiting (dec, until)) {
+      g_cond_wait (&dec->gop_cond, &dec->gop_lock);
     } else {
-      // Bits per pixel of image match output format.
-      if (stride == width) {
-        memcpy (dest, src, height * stride);
-        dest += (height * stride);
-      } else {
-        while (height--) {
-          memcpy (dest, src, width);
-          src += stride;
-          dest += width;
+      break;
+    }
+  }
+  g_mutex_unlock (&dec->gop_lock);
+  return ret;
+}
+
+// close the newest GOP and queue the given one for decoding
+static GstFlowReturn
+_gst_libde265_dec_gop_start (GstLibde265Dec * dec, struct GstLibde265Gop *gop)
+{
+  GstFlowReturn ret;
+
+  g_mutex_lock (&dec->gop_lock);
+  struct GstLibde265Gop *newest = g_queue_peek_tail (&dec->gops);
+  if (newest != NULL) {
+    newest->complete = TRUE;
+    g_cond_broadcast (&dec->gop_cond);
+  }
+  g_mutex_unlock (&dec->gop_lock);
+
+  if (newest != NULL && newest->length > dec->gop_length) {
+    // the latency grows with the longest GOP seen so far
+    GST_DEBUG_OBJECT (dec, "GOPs have up to %d frames", newest->length);
+    dec->gop_length = newest->length;
+    _gst_libde265_dec_update_latency (dec);
+  }
+
+  ret = _gst_libde265_dec_gop_drain (dec, GOP_WAIT_SLOT);
+  if (ret != GST_FLOW_OK) {
+    _gst_libde265_dec_gop_free (gop);
+    return ret;
+  }
+
+  g_mutex_lock (&dec->gop_lock);
+  g_queue_push_tail (&dec->gops, gop);
+  g_queue_push_tail (&dec->gop_queue, gop);
+  g_cond_broadcast (&dec->gop_cond);
+  g_mutex_unlock (&dec->gop_lock);
+  dec->parallel_gops++;
+  return GST_FLOW_OK;
+}
+
+// keep the data of a frame with a GOP that isn't decoded yet
+static void
+_gst_libde265_dec_gop_hold (struct GstLibde265Gop *gop, VIDEO_FRAME * frame,
+    GByteArray * data)
+{
+  struct GstLibde265GopInput *input = g_slice_new (struct GstLibde265GopInput);
+
+  input->data = data;
+  input->pts = (de265_PTS) FRAME_PTS (frame);
+  g_queue_push_tail (&gop->input, input);
+  g_queue_push_tail (&gop->frames, frame);
+  gop->length++;
+}
+
+// pass the data of a frame to the newest GOP
+static GstFlowReturn
+_gst_libde265_dec_gop_push (GstLibde265Dec * dec, VIDEO_FRAME * frame,
+    GByteArray * data)
+{
+  GstFlowReturn ret = _gst_libde265_dec_gop_drain (dec, GOP_WAIT_INPUT);
+
+  if (ret != GST_FLOW_OK) {
+    gst_video_codec_frame_unref (frame);
+    g_byte_array_unref (data);
+    return ret;
+  }
+
+  g_mutex_lock (&dec->gop_lock);
+  _gst_libde265_dec_gop_hold (g_queue_peek_tail (&dec->gops), frame, data);
+  g_cond_broadcast (&dec->gop_cond);
+  g_mutex_unlock (&dec->gop_lock);
+  return GST_FLOW_OK;
+}
+
+// the RASL pictures of a CRA picture continue the newest GOP
+static GstFlowReturn
+_gst_libde265_dec_gop_merge (GstLibde265Dec * dec, struct GstLibde265Gop *gop)
+{
+  struct GstLibde265GopInput *input;
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  GST_LOG_OBJECT (dec, "CRA picture with RASL pictures, not starting a GOP");
+  while (ret == GST_FLOW_OK
+      && (input = g_queue_pop_head (&gop->input)) != NULL) {
+    ret = _gst_libde265_dec_gop_push (dec, g_queue_pop_head (&gop->frames),
+        input->data);
+    g_slice_free (struct GstLibde265GopInput, input);
+  }
+  _gst_libde265_dec_gop_free (gop);
+  return ret;
+}
+
+/*
+ * Add the data of a frame to its GOP, "type" is the type of its first
+ * slice. IDR and BLA pictures always start a new GOP. A CRA picture only
+ * starts one if no RASL picture follows it, those reference pictures of
+ * the previous GOP, so the frames of its leading pictures are held back
+ * until that is known.
+ */
+static GstFlowReturn
+_gst_libde265_dec_gop_add (GstLibde265Dec * dec, VIDEO_FRAME * frame,
+    GByteArray * data, int type)
+{
+  struct GstLibde265Gop *gop = dec->gop_leading;
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  if (gop != NULL) {
+    if (type < 0 || GST_LIBDE265_NAL_IS_RADL (type)) {
+      _gst_libde265_dec_gop_hold (gop, frame, data);
+      return GST_FLOW_OK;
+    }
+    dec->gop_leading = NULL;
+    if (GST_LIBDE265_NAL_IS_RASL (type)) {
+      ret = _gst_libde265_dec_gop_merge (dec, gop);
+    } else {
+      ret = _gst_libde265_dec_gop_start (dec, gop);
+    }
+  }
+
+  if (ret == GST_FLOW_OK && GST_LIBDE265_NAL_IS_IRAP (type)) {
+    gop = _gst_libde265_dec_gop_new (dec);
+    if (type == GST_LIBDE265_NAL_CRA && !g_queue_is_empty (&dec->gops)) {
+      dec->gop_leading = gop;
+      _gst_libde265_dec_gop_hold (gop, frame, data);
+      return GST_FLOW_OK;
+    }
+    ret = _gst_libde265_dec_gop_start (dec, gop);
+  } else if (ret == GST_FLOW_OK && g_queue_is_empty (&dec->gops)) {
+    // the stream doesn't start with an IRAP picture
+    ret = _gst_libde265_dec_gop_start (dec, _gst_libde265_dec_gop_new (dec));
+  }
+
+  if (ret != GST_FLOW_OK) {
+    gst_video_codec_frame_unref (frame);
+    g_byte_array_unref (data);
+    return ret;
+  }
+  return _gst_libde265_dec_gop_push (dec, frame, data);
+}
+
+/*
+ * Collect the NAL units of a frame with start codes for the GOP it
+ * belongs to. Pictures are skipped like in _gst_libde265_dec_decode_frame.
+ */
+static GstFlowReturn
+_gst_libde265_dec_gop_frame (GstLibde265Dec * dec, VIDEO_FRAME * frame)
+{
+  static const guint8 start_code[] = { 0, 0, 1 };
+  VIDEO_DECODER_BASE *parse = GST_VIDEO_DECODER (dec);
+  const guint8 *pos;
+  const guint8 *nal;
+  gsize nal_size;
+  int found;
+  int type = -1;
+  int decoded_slices = 0;
+  int skipped_slices = 0;
+  gboolean skipped_by_qos = FALSE;
+  GstMapInfo info;
+
+  if (!gst_buffer_map (frame->input_buffer, &info, GST_MAP_READ)) {
+    GST_ERROR_OBJECT (dec, "Failed to map input buffer");
+    return GST_FLOW_ERROR;
+  }
+
+  _gst_libde265_dec_mark_decode_only (frame);
+  _gst_libde265_dec_update_qos (dec, frame);
+  gboolean clipped = _gst_libde265_dec_is_clipped (dec, FRAME_PTS (frame),
+      FRAME_DURATION (frame));
+  GByteArray *data = g_byte_array_sized_new (info.size + 64);
+  pos = info.data;
+  while ((found = _gst_libde265_dec_next_nal (dec, &pos,
+              info.data + info.size, &nal, &nal_size)) > 0) {
+    _gst_libde265_dec_inspect_nal (dec, nal, nal_size);
+    if (_gst_libde265_dec_skip_nal (dec, nal, nal_size, clipped,
+            &skipped_by_qos)) {
+      skipped_slices++;
+      continue;
+    }
+    if (nal_size >= 2) {
+      int nal_type = GST_LIBDE265_NAL_TYPE (nal);
+      if (GST_LIBDE265_NAL_IS_VCL (nal_type)) {
+        decoded_slices++;
+        if (type < 0) {
+          type = nal_type;
         }
+      } else if (nal_type >= GST_LIBDE265_NAL_VPS
+          && nal_type <= GST_LIBDE265_NAL_PPS) {
+        _gst_libde265_dec_remember_param_set (dec, nal, nal_size);
       }
     }
+    g_byte_array_append (data, start_code, sizeof (start_code));
+    g_byte_array_append (data, nal, nal_size);
+  }
+  gst_buffer_unmap (frame->input_buffer, &info);
+
+  if (found < 0) {
+    GST_ELEMENT_ERROR (parse, STREAM, DECODE,
+        ("Overflow in input data, check data mode"), (NULL));
+    g_byte_array_unref (data);
+    return GST_FLOW_ERROR;
+  }
+  if (skipped_slices > 0 && decoded_slices == 0) {
+    g_byte_array_unref (data);
+    GST_LOG_OBJECT (dec, "Skipped decoding of frame %d",
+        frame->system_frame_number);
+#if GST_CHECK_VERSION(1,2,2)
+    if (!skipped_by_qos) {
+      gst_video_decoder_release_frame (parse, frame);
+      return GST_FLOW_OK;
+    }
+#endif
+    return gst_video_decoder_drop_frame (parse, frame);
+  }
+
+  GstFlowReturn ret = _gst_libde265_dec_gop_add (dec, frame, data, type);
+  if (ret == GST_FLOW_OK) {
+    ret = _gst_libde265_dec_gop_drain (dec, GOP_WAIT_NONE);
+  }
+  return ret;
+}
+
+// decode and finish all GOPs, at the end of the stream or before new caps
+static GstFlowReturn
+_gst_libde265_dec_gop_drain_all (GstLibde265Dec * dec)
+{
+  struct GstLibde265Gop *gop = dec->gop_leading;
+
+  if (dec->gop_workers == NULL) {
+    return GST_FLOW_OK;
+  }
+  if (gop != NULL) {
+    dec->gop_leading = NULL;
+    GstFlowReturn ret = _gst_libde265_dec_gop_start (dec, gop);
+    if (ret != GST_FLOW_OK) {
+      return ret;
+    }
+  }
+
+  g_mutex_lock (&dec->gop_lock);
+  gop = g_queue_peek_tail (&dec->gops);
+  if (gop != NULL) {
+    gop->complete = TRUE;
+    g_cond_broadcast (&dec->gop_cond);
+  }
+  g_mutex_unlock (&dec->gop_lock);
+  return _gst_libde265_dec_gop_drain (dec, GOP_WAIT_ALL);
+}
+
+// drop all GOPs, waiting until the workers have stopped decoding them
+static void
+_gst_libde265_dec_gop_discard (GstLibde265Dec * dec)
+{
+  struct GstLibde265Gop *gop;
+  GList *walk;
+
+  if (dec->gop_leading != NULL) {
+    _gst_libde265_dec_gop_free (dec->gop_leading);
+    dec->gop_leading = NULL;
+  }
+
+  g_mutex_lock (&dec->gop_lock);
+  // no worker has taken these yet
+  while ((gop = g_queue_pop_head (&dec->gop_queue)) != NULL) {
+    gop->done = TRUE;
+  }
+  for (walk = dec->gops.head; walk != NULL; walk = walk->next) {
+    ((struct GstLibde265Gop *) walk->data)->discard = TRUE;
+  }
+  g_cond_broadcast (&dec->gop_cond);
+  while ((gop = g_queue_peek_head (&dec->gops)) != NULL) {
+    if (!gop->done) {
+      g_cond_wait (&dec->gop_cond, &dec->gop_lock);
+      continue;
+    }
+    g_queue_pop_head (&dec->gops);
+    g_mutex_unlock (&dec->gop_lock);
+    _gst_libde265_dec_gop_free (gop);
+    g_mutex_lock (&dec->gop_lock);
+  }
+  dec->gop_flow = GST_FLOW_OK;
+  g_free (dec->gop_error);
+  dec->gop_error = NULL;
+  g_mutex_unlock (&dec->gop_lock);
+}
+
+static void
+_gst_libde265_dec_gop_stop (GstLibde265Dec * dec)
+{
+  int i;
+
+  dec->gop_checked = FALSE;
+  if (dec->gop_workers == NULL) {
+    return;
+  }
+
+  _gst_libde265_dec_gop_discard (dec);
+  g_mutex_lock (&dec->gop_lock);
+  dec->gop_quit = TRUE;
+  g_cond_broadcast (&dec->gop_cond);
+  g_mutex_unlock (&dec->gop_lock);
+  for (i = 0; i < dec->gop_worker_count; i++) {
+    struct GstLibde265GopWorker *worker = &dec->gop_workers[i];
+    if (worker->thread != NULL) {
+      g_thread_join (worker->thread);
+    }
+    if (worker->ctx == NULL) {
+      continue;
+    }
+    if (dec->context_pool > 0) {
+      de265_reset (worker->ctx);
+      gst_libde265_pool_release (worker->ctx, 0, dec->context_pool);
+    } else {
+      de265_free_decoder (worker->ctx);
+    }
+  }
+  g_free (dec->gop_workers);
+  dec->gop_workers = NULL;
+  dec->gop_worker_count = 0;
+  dec->gop_length = 0;
+  gst_object_replace ((GstObject **) & dec->gop_pool, NULL);
+}
+
+/*
+ * Start the workers for GOP-parallel decoding. Live input is decoded
+ * normally, waiting for the pictures of a whole GOP would add latency.
+ */
+static gboolean
+_gst_libde265_dec_gop_start_workers (GstLibde265Dec * dec)
+{
+  GstQuery *query = gst_query_new_latency ();
+  gboolean live = FALSE;
+  int i;
+
+  dec->gop_checked = TRUE;
+  if (gst_pad_peer_query (GST_VIDEO_DECODER_SINK_PAD (dec), query)) {
+    gst_query_parse_latency (query, &live, NULL, NULL);
+  }
+  gst_query_unref (query);
+  if (live) {
+    GST_INFO_OBJECT (dec, "Live input, not decoding GOPs in parallel");
+    return TRUE;
+  }
+
+  dec->gop_quit = FALSE;
+  dec->gop_worker_count = dec->gop_parallel;
+  if (dec->thread_budget > 0) {
+    // every worker is one thread of the budget, at least one is needed
+    dec->gop_worker_count =
+        CLAMP (_gst_libde265_dec_join_budget (dec, dec->gop_parallel), 1,
+        dec->gop_parallel);
+  }
+  dec->gop_workers =
+      g_new0 (struct GstLibde265GopWorker, dec->gop_worker_count);
+  for (i = 0; i < dec->gop_worker_count; i++) {
+    struct GstLibde265GopWorker *worker = &dec->gop_workers[i];
+    int held;
+    worker->dec = dec;
+    // GOPs are decoded in parallel instead of the parts of a picture
+    if (dec->context_pool > 0) {
+      worker->ctx = gst_libde265_pool_acquire (0, &held);
+    }
+    if (worker->ctx == NULL) {
+      worker->ctx = de265_new_decoder ();
+    }
+    if (worker->ctx == NULL) {
+      GST_ELEMENT_ERROR (dec, LIBRARY, INIT,
+          ("Failed to create decoder context"), (NULL));
+      _gst_libde265_dec_gop_stop (dec);
+      return FALSE;
+    }
+    de265_set_parameter_bool (worker->ctx,
+        DE265_DECODER_PARAM_BOOL_SEI_CHECK_HASH, 0);
+    worker->thread =
+        g_thread_new ("libde265gop", _gst_libde265_dec_gop_loop, worker);
   }
+
+  if (dec->ctx_threads > 0 || dec->threads_pending) {
+    // the worker threads of the main context would only be idle
+    _gst_libde265_dec_release_context (dec);
+    if (!_gst_libde265_dec_create_context (dec)) {
+      GST_ELEMENT_ERROR (dec, LIBRARY, INIT,
+          ("Failed to create decoder context"), (NULL));
+      _gst_libde265_dec_gop_stop (dec);
+      return FALSE;
+    }
+    if (!_gst_libde265_dec_restore_param_sets (dec)) {
+      _gst_libde265_dec_gop_stop (dec);
+      return FALSE;
+    }
+  }
+  if (dec->threads != dec->gop_worker_count) {
+    dec->threads = dec->gop_worker_count;
+    g_object_notify (G_OBJECT (dec), "threads");
+  }
+  GST_INFO_OBJECT (dec, "Decoding GOPs with %d contexts in parallel",
+      dec->gop_worker_count);
+  return TRUE;
+}
+#endif
+
+static GstFlowReturn
+_gst_libde265_dec_process_frame (VIDEO_DECODER_BASE * parse,
+    VIDEO_FRAME * frame)
+{
+  GstLibde265Dec *dec = GST_LIBDE265_DEC (parse);
+  gint64 start = g_get_monotonic_time ();
 #if GST_CHECK_VERSION(1,0,0)
-  gst_buffer_unmap (frame->output_buffer, &info);
+  GstFlowReturn ret = dec->gop_workers != NULL ?
+      _gst_libde265_dec_gop_frame (dec, frame) :
+      _gst_libde265_dec_decode_frame (parse, frame);
+#else
+  GstFlowReturn ret = _gst_libde265_dec_decode_frame (parse, frame);
 #endif
-  FRAME_PTS (frame) = (GstClockTime) de265_get_image_PTS (img);
-  return FINISH_FRAME (parse, frame);
+  gint64 now = g_get_monotonic_time ();
 
-error_input:
+  gst_libde265_timing_add (&dec->frame_time, now - start);
+  if (dec->stats_interval > 0
+      && now - dec->stats_posted >= dec->stats_interval * (gint64) 1000) {
+    dec->stats_posted = now;
+    gst_element_post_message (GST_ELEMENT (dec),
+        gst_message_new_element (GST_OBJECT (dec),
+            _gst_libde265_dec_get_stats (dec)));
+  }
+  return ret;
+}
+
+static GstFlowReturn
+gst_libde265_dec_handle_frame (VIDEO_DECODER_BASE * parse, VIDEO_FRAME * frame)
+{
 #if GST_CHECK_VERSION(1,0,0)
-  gst_buffer_unmap (frame->input_buffer, &info);
+  GstLibde265Dec *dec = GST_LIBDE265_DEC (parse);
+
+  if (dec->gop_parallel > 0 && !dec->gop_checked
+      && !_gst_libde265_dec_gop_start_workers (dec)) {
+    return GST_FLOW_ERROR;
+  }
+  if (dec->async_thread != NULL && dec->gop_workers == NULL) {
+    return _gst_libde265_dec_async_push (dec, frame);
+  }
 #endif
-  return GST_FLOW_ERROR;
+  return _gst_libde265_dec_process_frame (parse, frame);
+}
+
+#if GST_CHECK_VERSION(1,0,0)
+static GstFlowReturn
+gst_libde265_dec_finish (VIDEO_DECODER_BASE * parse)
+{
+  GstLibde265Dec *dec = GST_LIBDE265_DEC (parse);
+
+  _gst_libde265_dec_async_wait (dec, FALSE);
+  if (dec->gop_workers != NULL) {
+    return _gst_libde265_dec_gop_drain_all (dec);
+  }
+  return dec->async_thread != NULL ? dec->async_flow : GST_FLOW_OK;
 }
+#endif
 
 gboolean
 gst_libde265_dec_plugin_init (GstPlugin * plugin)
 {
+  GstLibde265CopyImpl impl =
+      gst_libde265_copy_select (GST_LIBDE265_COPY_IMPL_AUTO);
+  GST_INFO ("Using %s plane copy kernels", gst_libde265_copy_impl_name (impl));
+
   /* create an elementfactory for the libde265 decoder element */
   if (!gst_element_register (plugin, "libde265dec",
           GST_RANK_PRIMARY, GST_TYPE_LIBDE265_DEC))
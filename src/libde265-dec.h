@@ -38,10 +38,12 @@
     #define VIDEO_STATE             GstVideoCodecState
     #define NEED_DATA_RESULT        GST_VIDEO_DECODER_FLOW_NEED_DATA
     #define GET_FRAME               gst_video_decoder_get_frame
+    #define GET_OLDEST_FRAME        gst_video_decoder_get_oldest_frame
     #define HAVE_FRAME              gst_video_decoder_have_frame
     #define FINISH_FRAME            gst_video_decoder_finish_frame
     #define ALLOC_OUTPUT_FRAME      gst_video_decoder_allocate_output_frame
     #define FRAME_PTS(frame)        ((frame)->pts)
+    #define FRAME_DURATION(frame)   ((frame)->duration)
 #else
     #include <gst/video/gstbasevideodecoder.h>
 
@@ -53,14 +55,19 @@
     #define VIDEO_STATE             GstVideoState
     #define NEED_DATA_RESULT        GST_BASE_VIDEO_DECODER_FLOW_NEED_DATA
     #define GET_FRAME               gst_base_video_decoder_get_frame
+    #define GET_OLDEST_FRAME        gst_base_video_decoder_get_oldest_frame
     #define HAVE_FRAME              gst_base_video_decoder_have_frame
     #define FINISH_FRAME            gst_base_video_decoder_finish_frame
     #define ALLOC_OUTPUT_FRAME      gst_base_video_decoder_alloc_src_frame
     #define FRAME_PTS(frame)        ((frame)->presentation_timestamp)
+    #define FRAME_DURATION(frame)   ((frame)->presentation_duration)
 #endif
 
 #include <libde265/de265.h>
 
+#include "libde265-nal.h"
+#include "libde265-stats.h"
+
 G_BEGIN_DECLS
 
 #define GST_TYPE_LIBDE265_DEC \
@@ -76,6 +83,27 @@ typedef enum {
   GST_TYPE_LIBDE265_DEC_RAW
 } GstLibde265DecMode;
 
+typedef enum {
+  GST_TYPE_LIBDE265_DEC_THREADS_CORES,
+  GST_TYPE_LIBDE265_DEC_THREADS_RESOLUTION
+} GstLibde265DecThreadsPolicy;
+
+typedef enum {
+  GST_TYPE_LIBDE265_DEC_SKIP_NONE,
+  GST_TYPE_LIBDE265_DEC_SKIP_NON_IRAP
+} GstLibde265DecSkipFrames;
+
+typedef enum {
+  GST_TYPE_LIBDE265_DEC_SCALE_FULL = 1,
+  GST_TYPE_LIBDE265_DEC_SCALE_HALF = 2,
+  GST_TYPE_LIBDE265_DEC_SCALE_QUARTER = 4
+} GstLibde265DecOutputScale;
+
+typedef enum {
+  GST_TYPE_LIBDE265_DEC_MEMORY_SYSTEM,
+  GST_TYPE_LIBDE265_DEC_MEMORY_MEMFD
+} GstLibde265DecOutputMemory;
+
 typedef struct _GstLibde265Dec {
     VIDEO_DECODER_BASE      parent;
 
@@ -83,18 +111,114 @@ typedef struct _GstLibde265Dec {
     de265_decoder_context   *ctx;
     int                     width;
     int                     height;
+    int                     coded_width;
+    int                     coded_height;
+    int                     crop_left;
+    int                     crop_top;
+    int                     alignment;
     GstLibde265DecMode      mode;
     int                     length_size;
+    gboolean                au_input;
+    gboolean                batch_nal_units;
+    guint8                  *nal_arena;
+    gsize                   nal_arena_size;
+    guint                   batched_nals;
     int                     fps_n;
     int                     fps_d;
+    int                     max_temporal_layer;
+    int                     highest_tid;
+    int                     rate_divider;
+    GstLibde265DecSkipFrames skip_frames;
+    gboolean                raw_skipping;
+    gboolean                no_rasl_output;
+    gboolean                skip_rasl;
+    gboolean                low_latency;
+    GstLibde265DecOutputScale output_scale;
+    guint                   stats_interval;
+    gint64                  stats_posted;
+    GstLibde265Timing       frame_time;
+    gint64                  push_time;
+    gint64                  decode_time;
+    gint64                  convert_time;
+    gint64                  parallel_copy_time;
+    guint                   parallel_copies;
+    guint                   buffer_full_events;
+    int                     pending_nals;
     int                     max_threads;
+    int                     thread_budget;
+    int                     threads;
+    int                     threads_wanted;
+    int                     ctx_threads;
+    int                     context_pool;
+    guint                   pooled_contexts;
+    GstLibde265DecThreadsPolicy threads_policy;
+    gboolean                threads_pending;
+    gboolean                threads_resize;
+    GstLibde265SPS          sps;
+    GstLibde265PPS          pps;
+    gboolean                have_sps;
+    gboolean                have_pps;
+    int                     qos_level;
+    int                     qos_late;
+    int                     qos_on_time;
     int                     buffer_full;
-    void                    *codec_data;
-    int                     codec_data_size;
+    struct GstLibde265ParamSets *param_sets;
+    GList                   *param_set_cache;
+    GQueue                  param_history;
 #if GST_CHECK_VERSION(1,0,0)
     int                     frame_number;
+    gboolean                parse_have_vcl;
     GstVideoCodecState      *input_state;
     GstVideoCodecState      *output_state;
+    GstVideoFormat          planar_format;
+    GstVideoFormat          output_format;
+    gboolean                use_crop_meta;
+    gboolean                use_padding;
+    gboolean                use_video_meta;
+    gboolean                export_frames;
+    GstLibde265DecOutputMemory output_memory;
+    GstAllocator            *memfd_allocator;
+    gboolean                huge_pages;
+    GstAllocator            *hugepage_allocator;
+    guint                   direct_frames;
+    guint                   fallback_frames;
+    // copied because downstream only accepts a semi-planar format
+    guint                   semi_planar_frames;
+    guint                   exported_frames;
+    guint                   clipped_frames;
+    struct GstLibde265FrameRef *frame_ref_free;
+    GSList                  *frame_ref_slabs;
+    int                     async_depth;
+    GThread                 *async_thread;
+    GMutex                  async_lock;
+    GCond                   async_cond;
+    VIDEO_FRAME             **async_queue;
+    int                     async_size;
+    int                     async_head;
+    int                     async_count;
+    gboolean                async_busy;
+    gboolean                async_quit;
+    GstFlowReturn           async_flow;
+    int                     latency_min_frames;
+    int                     latency_max_frames;
+    int                     gop_parallel;
+    int                     max_gops_in_flight;
+    gboolean                gop_checked;
+    struct GstLibde265GopWorker *gop_workers;
+    int                     gop_worker_count;
+    GMutex                  gop_lock;
+    GCond                   gop_cond;
+    GQueue                  gops;
+    GQueue                  gop_queue;
+    struct GstLibde265Gop   *gop_leading;
+    gboolean                gop_quit;
+    GstFlowReturn           gop_flow;
+    gchar                   *gop_error;
+    GstBufferPool           *gop_pool;
+    GstVideoInfo            gop_info;
+    gboolean                gop_crop_meta;
+    int                     gop_length;
+    guint                   parallel_gops;
 #endif
 } GstLibde265Dec;
 
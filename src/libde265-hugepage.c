@@ -0,0 +1,252 @@
+/*
+ * GStreamer HEVC/H.265 video codec.
+ *
+ * Copyright (c) 2014 struktur AG, Joachim Bauch <bauch@struktur.de>
+ *
+ * This file is part of gstreamer-libde265.
+ *
+ * libde265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libde265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libde265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "libde265-hugepage.h"
+
+#ifdef HAVE_HUGEPAGE_OUTPUT
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS           MAP_ANON
+#endif
+
+// used if the size can't be read from /proc/meminfo
+#define DEFAULT_HUGE_PAGE_SIZE  (2 * 1024 * 1024)
+
+#define GST_LIBDE265_HUGEPAGE_MEMORY_TYPE   "Libde265HugepageMemory"
+
+typedef struct
+{
+  GstMemory mem;
+  guint8 *data;
+  // length of the mapping, 0 for memory shared from a parent
+  gsize length;
+} GstLibde265HugepageMemory;
+
+G_DEFINE_TYPE (GstLibde265HugepageAllocator, gst_libde265_hugepage_allocator,
+    GST_TYPE_ALLOCATOR);
+
+static gsize
+_gst_libde265_hugepage_size (void)
+{
+  gsize size = DEFAULT_HUGE_PAGE_SIZE;
+  char line[128];
+  FILE *fp = fopen ("/proc/meminfo", "r");
+  if (fp == NULL) {
+    return size;
+  }
+  while (fgets (line, sizeof (line), fp) != NULL) {
+    unsigned long kb;
+    if (sscanf (line, "Hugepagesize: %lu kB", &kb) == 1 && kb > 0) {
+      size = (gsize) kb * 1024;
+      break;
+    }
+  }
+  fclose (fp);
+  return size;
+}
+
+#ifdef MADV_HUGEPAGE
+// transparent huge pages are only used for naturally aligned ranges
+static guint8 *
+_gst_libde265_hugepage_map_aligned (gsize length, gsize page_size)
+{
+  gsize mapped = length + page_size;
+  guint8 *data = mmap (NULL, mapped, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data == MAP_FAILED) {
+    return NULL;
+  }
+  guint8 *aligned = (guint8 *) (((guintptr) data + page_size - 1)
+      & ~(guintptr) (page_size - 1));
+  if (aligned > data) {
+    munmap (data, aligned - data);
+  }
+  if (aligned + length < data + mapped) {
+    munmap (aligned + length, data + mapped - (aligned + length));
+  }
+  return aligned;
+}
+#endif
+
+static GstMemory *
+gst_libde265_hugepage_allocator_alloc (GstAllocator * allocator, gsize size,
+    GstAllocationParams * params)
+{
+  GstLibde265HugepageAllocator *self =
+      GST_LIBDE265_HUGEPAGE_ALLOCATOR (allocator);
+  GstLibde265HugepageBacking backing = GST_LIBDE265_HUGEPAGE_NONE;
+  // the memory is mapped page aligned, which satisfies any alignment
+  // requested by the decoder
+  gsize maxsize = size + params->prefix + params->padding;
+  gsize length = 0;
+  guint8 *data = NULL;
+
+  if (maxsize >= self->page_size) {
+    length = (maxsize + self->page_size - 1) & ~(self->page_size - 1);
+#ifdef MAP_HUGETLB
+    data = mmap (NULL, length, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (data != MAP_FAILED) {
+      backing = GST_LIBDE265_HUGEPAGE_EXPLICIT;
+    } else {
+      // the reserved pool is empty or not configured
+      data = NULL;
+    }
+#endif
+#ifdef MADV_HUGEPAGE
+    if (data == NULL) {
+      data = _gst_libde265_hugepage_map_aligned (length, self->page_size);
+      if (data != NULL && madvise (data, length, MADV_HUGEPAGE) == 0) {
+        backing = GST_LIBDE265_HUGEPAGE_TRANSPARENT;
+      }
+    }
+#endif
+
+    gint previous = g_atomic_int_get (&self->backing);
+    g_atomic_int_set (&self->backing, backing);
+    if (previous != (gint) backing) {
+      GST_INFO_OBJECT (self, "Allocated %" G_GSIZE_FORMAT " bytes with %s "
+          "huge pages", maxsize, gst_libde265_hugepage_backing_name (backing));
+    }
+  }
+
+  if (data == NULL) {
+    length = maxsize;
+    data = mmap (NULL, length, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+      GST_WARNING_OBJECT (self, "Could not map %" G_GSIZE_FORMAT " bytes: %s",
+          length, g_strerror (errno));
+      return NULL;
+    }
+  }
+
+  GstLibde265HugepageMemory *mem = g_slice_new (GstLibde265HugepageMemory);
+  gst_memory_init (GST_MEMORY_CAST (mem), 0, allocator, NULL, maxsize,
+      params->align, params->prefix, size);
+  mem->data = data;
+  mem->length = length;
+  return GST_MEMORY_CAST (mem);
+}
+
+static void
+gst_libde265_hugepage_allocator_free (GstAllocator * allocator,
+    GstMemory * memory)
+{
+  GstLibde265HugepageMemory *mem = (GstLibde265HugepageMemory *) memory;
+  if (mem->length > 0) {
+    munmap (mem->data, mem->length);
+  }
+  g_slice_free (GstLibde265HugepageMemory, mem);
+}
+
+static gpointer
+gst_libde265_hugepage_memory_map (GstMemory * memory, gsize maxsize,
+    GstMapFlags flags)
+{
+  return ((GstLibde265HugepageMemory *) memory)->data;
+}
+
+static void
+gst_libde265_hugepage_memory_unmap (GstMemory * memory)
+{
+}
+
+static GstMemory *
+gst_libde265_hugepage_memory_share (GstMemory * memory, gssize offset,
+    gssize size)
+{
+  GstLibde265HugepageMemory *mem = (GstLibde265HugepageMemory *) memory;
+  GstMemory *parent = memory->parent != NULL ? memory->parent : memory;
+
+  if (size == -1) {
+    size = memory->size - offset;
+  }
+
+  GstLibde265HugepageMemory *sub = g_slice_new (GstLibde265HugepageMemory);
+  gst_memory_init (GST_MEMORY_CAST (sub),
+      GST_MINI_OBJECT_FLAGS (parent) | GST_MINI_OBJECT_FLAG_LOCK_READONLY,
+      memory->allocator, parent, memory->maxsize, memory->align,
+      memory->offset + offset, size);
+  sub->data = mem->data;
+  sub->length = 0;
+  return GST_MEMORY_CAST (sub);
+}
+
+static void
+gst_libde265_hugepage_allocator_class_init (GstLibde265HugepageAllocatorClass
+    * klass)
+{
+  GstAllocatorClass *allocator_class = GST_ALLOCATOR_CLASS (klass);
+
+  allocator_class->alloc = gst_libde265_hugepage_allocator_alloc;
+  allocator_class->free = gst_libde265_hugepage_allocator_free;
+}
+
+static void
+gst_libde265_hugepage_allocator_init (GstLibde265HugepageAllocator *
+    allocator)
+{
+  GstAllocator *parent = GST_ALLOCATOR_CAST (allocator);
+
+  parent->mem_type = GST_LIBDE265_HUGEPAGE_MEMORY_TYPE;
+  parent->mem_map = gst_libde265_hugepage_memory_map;
+  parent->mem_unmap = gst_libde265_hugepage_memory_unmap;
+  parent->mem_share = gst_libde265_hugepage_memory_share;
+  allocator->page_size = _gst_libde265_hugepage_size ();
+  allocator->backing = GST_LIBDE265_HUGEPAGE_NONE;
+}
+
+GstAllocator *
+gst_libde265_hugepage_allocator_new (void)
+{
+  return g_object_new (GST_TYPE_LIBDE265_HUGEPAGE_ALLOCATOR, NULL);
+}
+
+GstLibde265HugepageBacking
+gst_libde265_hugepage_allocator_get_backing (GstAllocator * allocator)
+{
+  return g_atomic_int_get (&GST_LIBDE265_HUGEPAGE_ALLOCATOR
+      (allocator)->backing);
+}
+
+const char *
+gst_libde265_hugepage_backing_name (GstLibde265HugepageBacking backing)
+{
+  switch (backing) {
+    case GST_LIBDE265_HUGEPAGE_EXPLICIT:
+      return "explicit";
+    case GST_LIBDE265_HUGEPAGE_TRANSPARENT:
+      return "transparent";
+    case GST_LIBDE265_HUGEPAGE_NONE:
+    default:
+      return "none";
+  }
+}
+#endif
@@ -0,0 +1,82 @@
+/*
+ * GStreamer HEVC/H.265 video codec.
+ *
+ * Copyright (c) 2014 struktur AG, Joachim Bauch <bauch@struktur.de>
+ *
+ * This file is part of gstreamer-libde265.
+ *
+ * libde265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libde265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libde265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GST_LIBDE265_HUGEPAGE_H__
+#define __GST_LIBDE265_HUGEPAGE_H__
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <gst/gst.h>
+
+#ifdef HAVE_HUGEPAGE_OUTPUT
+
+G_BEGIN_DECLS
+
+typedef enum {
+  GST_LIBDE265_HUGEPAGE_NONE,
+  GST_LIBDE265_HUGEPAGE_TRANSPARENT,
+  GST_LIBDE265_HUGEPAGE_EXPLICIT
+} GstLibde265HugepageBacking;
+
+/*
+ * Allocator for memory backed by huge pages. Allocations first try pages
+ * from the reserved huge page pool (MAP_HUGETLB), then ask for transparent
+ * huge pages (MADV_HUGEPAGE) and finally use normal pages. Allocations of
+ * less than a huge page always use normal pages.
+ */
+#define GST_TYPE_LIBDE265_HUGEPAGE_ALLOCATOR \
+    (gst_libde265_hugepage_allocator_get_type ())
+#define GST_LIBDE265_HUGEPAGE_ALLOCATOR(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_LIBDE265_HUGEPAGE_ALLOCATOR,GstLibde265HugepageAllocator))
+
+typedef struct _GstLibde265HugepageAllocator {
+    GstAllocator            parent;
+
+    /* private */
+    gsize                   page_size;
+    gint                    backing;
+} GstLibde265HugepageAllocator;
+
+typedef struct _GstLibde265HugepageAllocatorClass {
+    GstAllocatorClass       parent;
+} GstLibde265HugepageAllocatorClass;
+
+GType gst_libde265_hugepage_allocator_get_type (void);
+
+GstAllocator *gst_libde265_hugepage_allocator_new (void);
+
+/*
+ * Return the backing obtained by the most recent allocation that was
+ * large enough for huge pages, NONE if there was no such allocation yet.
+ */
+GstLibde265HugepageBacking
+gst_libde265_hugepage_allocator_get_backing (GstAllocator * allocator);
+
+const char *gst_libde265_hugepage_backing_name (GstLibde265HugepageBacking
+    backing);
+
+G_END_DECLS
+
+#endif  // HAVE_HUGEPAGE_OUTPUT
+
+#endif  // __GST_LIBDE265_HUGEPAGE_H__
@@ -0,0 +1,90 @@
+/*
+ * GStreamer HEVC/H.265 video codec.
+ *
+ * Copyright (c) 2014 struktur AG, Joachim Bauch <bauch@struktur.de>
+ *
+ * This file is part of gstreamer-libde265.
+ *
+ * libde265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libde265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libde265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE             // memfd_create
+#endif
+
+#include "libde265-memfd.h"
+
+#ifdef HAVE_MEMFD_OUTPUT
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+G_DEFINE_TYPE (GstLibde265MemfdAllocator, gst_libde265_memfd_allocator,
+    GST_TYPE_FD_ALLOCATOR);
+
+static GstMemory *
+gst_libde265_memfd_allocator_alloc (GstAllocator * allocator, gsize size,
+    GstAllocationParams * params)
+{
+  // the memory is mapped page aligned, which satisfies any alignment
+  // requested by the decoder
+  gsize maxsize = size + params->prefix + params->padding;
+  int fd = memfd_create ("libde265dec", MFD_CLOEXEC);
+  if (fd < 0) {
+    GST_WARNING ("Could not create memfd: %s", g_strerror (errno));
+    return NULL;
+  }
+  if (ftruncate (fd, maxsize) < 0) {
+    GST_WARNING ("Could not resize memfd to %" G_GSIZE_FORMAT " bytes: %s",
+        maxsize, g_strerror (errno));
+    close (fd);
+    return NULL;
+  }
+
+  // the fd is owned by the memory from now on
+  GstMemory *mem = gst_fd_allocator_alloc (allocator, fd, maxsize,
+      GST_FD_MEMORY_FLAG_KEEP_MAPPED);
+  if (mem == NULL) {
+    close (fd);
+    return NULL;
+  }
+  gst_memory_resize (mem, params->prefix, size);
+  return mem;
+}
+
+static void
+gst_libde265_memfd_allocator_class_init (GstLibde265MemfdAllocatorClass *
+    klass)
+{
+  GstAllocatorClass *allocator_class = GST_ALLOCATOR_CLASS (klass);
+
+  allocator_class->alloc = gst_libde265_memfd_allocator_alloc;
+}
+
+static void
+gst_libde265_memfd_allocator_init (GstLibde265MemfdAllocator * allocator)
+{
+}
+
+GstAllocator *
+gst_libde265_memfd_allocator_new (void)
+{
+  return g_object_new (GST_TYPE_LIBDE265_MEMFD_ALLOCATOR, NULL);
+}
+#endif
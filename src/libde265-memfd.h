@@ -0,0 +1,60 @@
+/*
+ * GStreamer HEVC/H.265 video codec.
+ *
+ * Copyright (c) 2014 struktur AG, Joachim Bauch <bauch@struktur.de>
+ *
+ * This file is part of gstreamer-libde265.
+ *
+ * libde265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libde265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libde265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GST_LIBDE265_MEMFD_H__
+#define __GST_LIBDE265_MEMFD_H__
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <gst/gst.h>
+
+#ifdef HAVE_MEMFD_OUTPUT
+#include <gst/allocators/allocators.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Allocator for memory backed by anonymous memfd files. The memory is fd
+ * memory (see gst_fd_memory_get_fd), so buffers can be passed to other
+ * processes without copying them.
+ */
+#define GST_TYPE_LIBDE265_MEMFD_ALLOCATOR \
+    (gst_libde265_memfd_allocator_get_type ())
+
+typedef struct _GstLibde265MemfdAllocator {
+    GstFdAllocator          parent;
+} GstLibde265MemfdAllocator;
+
+typedef struct _GstLibde265MemfdAllocatorClass {
+    GstFdAllocatorClass     parent;
+} GstLibde265MemfdAllocatorClass;
+
+GType gst_libde265_memfd_allocator_get_type (void);
+
+GstAllocator *gst_libde265_memfd_allocator_new (void);
+
+G_END_DECLS
+
+#endif  // HAVE_MEMFD_OUTPUT
+
+#endif  // __GST_LIBDE265_MEMFD_H__
@@ -0,0 +1,291 @@
+/*
+ * GStreamer HEVC/H.265 video codec.
+ *
+ * Copyright (c) 2014 struktur AG, Joachim Bauch <bauch@struktur.de>
+ *
+ * This file is part of gstreamer-libde265.
+ *
+ * libde265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libde265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libde265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "libde265-nal.h"
+
+// bit reader over the RBSP, skips emulation prevention bytes
+typedef struct
+{
+  const guint8 *data;
+  const guint8 *end;
+  int zeros;
+  guint32 cache;
+  int bits;
+  gboolean error;
+} BitReader;
+
+static void
+_bit_reader_init (BitReader * reader, const guint8 * data, gsize size)
+{
+  memset (reader, 0, sizeof (*reader));
+  reader->data = data;
+  reader->end = data + size;
+}
+
+static gboolean
+_bit_reader_fill (BitReader * reader)
+{
+  while (reader->data < reader->end) {
+    guint8 byte = *reader->data++;
+    if (reader->zeros >= 2 && byte == 0x03) {
+      reader->zeros = 0;
+      continue;
+    }
+    reader->zeros = (byte == 0) ? reader->zeros + 1 : 0;
+    reader->cache = (reader->cache << 8) | byte;
+    reader->bits += 8;
+    return TRUE;
+  }
+  reader->error = TRUE;
+  return FALSE;
+}
+
+static guint32
+_read_bits (BitReader * reader, int count)
+{
+  guint32 result = 0;
+  while (count > 0) {
+    int take;
+    if (reader->bits == 0 && !_bit_reader_fill (reader)) {
+      return 0;
+    }
+    take = MIN (count, reader->bits);
+    reader->bits -= take;
+    result = (result << take) |
+        ((reader->cache >> reader->bits) & ((1u << take) - 1));
+    count -= take;
+  }
+  return result;
+}
+
+static guint32
+_read_ue (BitReader * reader)
+{
+  int leading = 0;
+  while (!reader->error && _read_bits (reader, 1) == 0) {
+    if (++leading > 31) {
+      reader->error = TRUE;
+      return 0;
+    }
+  }
+  if (leading == 0) {
+    return 0;
+  }
+  return ((1u << leading) - 1) + _read_bits (reader, leading);
+}
+
+static gint32
+_read_se (BitReader * reader)
+{
+  guint32 value = _read_ue (reader);
+  return (value & 1) ? (gint32) ((value + 1) / 2) : -(gint32) (value / 2);
+}
+
+static void
+_skip_profile_tier_level (BitReader * reader, int max_sub_layers_minus1)
+{
+  gboolean profile_present[8];
+  gboolean level_present[8];
+  int i;
+
+  // general profile (88 bits) and level (8 bits)
+  _read_bits (reader, 32);
+  _read_bits (reader, 32);
+  _read_bits (reader, 32);
+  for (i = 0; i < max_sub_layers_minus1; i++) {
+    profile_present[i] = _read_bits (reader, 1);
+    level_present[i] = _read_bits (reader, 1);
+  }
+  if (max_sub_layers_minus1 > 0) {
+    for (i = max_sub_layers_minus1; i < 8; i++) {
+      _read_bits (reader, 2);
+    }
+  }
+  for (i = 0; i < max_sub_layers_minus1; i++) {
+    if (profile_present[i]) {
+      _read_bits (reader, 32);
+      _read_bits (reader, 32);
+      _read_bits (reader, 24);
+    }
+    if (level_present[i]) {
+      _read_bits (reader, 8);
+    }
+  }
+}
+
+gboolean
+gst_libde265_nal_parse_sps (const guint8 * nal, gsize size,
+    GstLibde265SPS * sps)
+{
+  BitReader reader;
+  int max_sub_layers_minus1;
+  int i;
+
+  if (size < 3 || GST_LIBDE265_NAL_TYPE (nal) != GST_LIBDE265_NAL_SPS) {
+    return FALSE;
+  }
+
+  memset (sps, 0, sizeof (*sps));
+  _bit_reader_init (&reader, nal + 2, size - 2);
+  _read_bits (&reader, 4);      // sps_video_parameter_set_id
+  max_sub_layers_minus1 = _read_bits (&reader, 3);
+  if (max_sub_layers_minus1 >= GST_LIBDE265_MAX_SUB_LAYERS) {
+    return FALSE;
+  }
+  sps->max_sub_layers = max_sub_layers_minus1 + 1;
+  _read_bits (&reader, 1);      // sps_temporal_id_nesting_flag
+  _skip_profile_tier_level (&reader, max_sub_layers_minus1);
+  _read_ue (&reader);           // sps_seq_parameter_set_id
+  sps->chroma_format_idc = _read_ue (&reader);
+  if (sps->chroma_format_idc == 3) {
+    _read_bits (&reader, 1);    // separate_colour_plane_flag
+  }
+  sps->width = _read_ue (&reader);
+  sps->height = _read_ue (&reader);
+  if (_read_bits (&reader, 1)) {
+    // conformance window, the decoder reports the cropped size itself
+    for (i = 0; i < 4; i++) {
+      _read_ue (&reader);
+    }
+  }
+  sps->bit_depth_luma = _read_ue (&reader) + 8;
+  sps->bit_depth_chroma = _read_ue (&reader) + 8;
+  _read_ue (&reader);           // log2_max_pic_order_cnt_lsb_minus4
+
+  gboolean ordering_info_present = _read_bits (&reader, 1);
+  for (i = ordering_info_present ? 0 : max_sub_layers_minus1;
+      i <= max_sub_layers_minus1; i++) {
+    sps->max_dec_pic_buffering[i] = _read_ue (&reader) + 1;
+    sps->max_num_reorder_pics[i] = _read_ue (&reader);
+    sps->max_latency_increase_plus1[i] = _read_ue (&reader);
+  }
+  if (!ordering_info_present) {
+    // values of the highest sub-layer apply to all lower sub-layers
+    for (i = 0; i < max_sub_layers_minus1; i++) {
+      sps->max_dec_pic_buffering[i] =
+          sps->max_dec_pic_buffering[max_sub_layers_minus1];
+      sps->max_num_reorder_pics[i] =
+          sps->max_num_reorder_pics[max_sub_layers_minus1];
+      sps->max_latency_increase_plus1[i] =
+          sps->max_latency_increase_plus1[max_sub_layers_minus1];
+    }
+  }
+
+  int log2_min_cb_size = _read_ue (&reader) + 3;
+  int log2_ctb_size = log2_min_cb_size + _read_ue (&reader);
+  if (reader.error || log2_ctb_size < 4 || log2_ctb_size > 6
+      || sps->width <= 0 || sps->height <= 0) {
+    return FALSE;
+  }
+  sps->ctb_size = 1 << log2_ctb_size;
+  return TRUE;
+}
+
+gboolean
+gst_libde265_nal_parse_pps (const guint8 * nal, gsize size,
+    GstLibde265PPS * pps)
+{
+  BitReader reader;
+
+  if (size < 3 || GST_LIBDE265_NAL_TYPE (nal) != GST_LIBDE265_NAL_PPS) {
+    return FALSE;
+  }
+
+  memset (pps, 0, sizeof (*pps));
+  _bit_reader_init (&reader, nal + 2, size - 2);
+  _read_ue (&reader);           // pps_pic_parameter_set_id
+  _read_ue (&reader);           // pps_seq_parameter_set_id
+  _read_bits (&reader, 1);      // dependent_slice_segments_enabled_flag
+  _read_bits (&reader, 1);      // output_flag_present_flag
+  _read_bits (&reader, 3);      // num_extra_slice_header_bits
+  _read_bits (&reader, 1);      // sign_data_hiding_enabled_flag
+  _read_bits (&reader, 1);      // cabac_init_present_flag
+  _read_ue (&reader);           // num_ref_idx_l0_default_active_minus1
+  _read_ue (&reader);           // num_ref_idx_l1_default_active_minus1
+  _read_se (&reader);           // init_qp_minus26
+  _read_bits (&reader, 1);      // constrained_intra_pred_flag
+  _read_bits (&reader, 1);      // transform_skip_enabled_flag
+  if (_read_bits (&reader, 1)) {
+    _read_ue (&reader);         // diff_cu_qp_delta_depth
+  }
+  _read_se (&reader);           // pps_cb_qp_offset
+  _read_se (&reader);           // pps_cr_qp_offset
+  _read_bits (&reader, 1);      // pps_slice_chroma_qp_offsets_present_flag
+  _read_bits (&reader, 1);      // weighted_pred_flag
+  _read_bits (&reader, 1);      // weighted_bipred_flag
+  _read_bits (&reader, 1);      // transquant_bypass_enabled_flag
+  pps->tiles_enabled = _read_bits (&reader, 1);
+  pps->entropy_coding_sync_enabled = _read_bits (&reader, 1);
+  pps->num_tile_columns = 1;
+  pps->num_tile_rows = 1;
+  if (pps->tiles_enabled) {
+    pps->num_tile_columns = _read_ue (&reader) + 1;
+    pps->num_tile_rows = _read_ue (&reader) + 1;
+  }
+  return !reader.error;
+}
+
+gboolean
+gst_libde265_nal_starts_access_unit (const guint8 * nal)
+{
+  int type = GST_LIBDE265_NAL_TYPE (nal);
+
+  if (GST_LIBDE265_NAL_IS_VCL (type)) {
+    return GST_LIBDE265_NAL_FIRST_SLICE (nal);
+  }
+  // see "Order of NAL units and coded pictures" in the specification
+  return (type >= GST_LIBDE265_NAL_VPS && type <= GST_LIBDE265_NAL_AUD)
+      || type == GST_LIBDE265_NAL_PREFIX_SEI
+      || (type >= GST_LIBDE265_NAL_RSV_NVCL41
+      && type <= GST_LIBDE265_NAL_RSV_NVCL44)
+      || (type >= GST_LIBDE265_NAL_UNSPEC48
+      && type <= GST_LIBDE265_NAL_UNSPEC55);
+}
+
+const guint8 *
+gst_libde265_nal_find_start_code (const guint8 * data, const guint8 * end)
+{
+  const guint8 *pos;
+
+  if (end - data < 3) {
+    return NULL;
+  }
+  pos = data + 2;
+  // look for the 0x01 with memchr, which is vectorized by the C library,
+  // then check for the two zero bytes in front of it
+  while (pos < end) {
+    pos = memchr (pos, 0x01, end - pos);
+    if (pos == NULL) {
+      return NULL;
+    }
+    if (pos[-1] == 0 && pos[-2] == 0) {
+      return pos - 2;
+    }
+    pos++;
+  }
+  return NULL;
+}
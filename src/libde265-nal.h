@@ -0,0 +1,125 @@
+/*
+ * GStreamer HEVC/H.265 video codec.
+ *
+ * Copyright (c) 2014 struktur AG, Joachim Bauch <bauch@struktur.de>
+ *
+ * This file is part of gstreamer-libde265.
+ *
+ * libde265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libde265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libde265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GST_LIBDE265_NAL_H__
+#define __GST_LIBDE265_NAL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Minimal parsing of H.265 NAL units, only what the decoder element needs
+ * to know about a stream before libde265 has decoded it.
+ */
+
+#define GST_LIBDE265_NAL_TYPE(nal)          (((nal)[0] >> 1) & 0x3f)
+#define GST_LIBDE265_NAL_TEMPORAL_ID(nal)   (((nal)[1] & 0x07) - 1)
+
+enum
+{
+  GST_LIBDE265_NAL_TRAIL_N = 0,
+  GST_LIBDE265_NAL_TSA_N = 2,
+  GST_LIBDE265_NAL_STSA_R = 5,
+  GST_LIBDE265_NAL_RADL_N = 6,
+  GST_LIBDE265_NAL_RADL_R = 7,
+  GST_LIBDE265_NAL_RASL_N = 8,
+  GST_LIBDE265_NAL_RASL_R = 9,
+  GST_LIBDE265_NAL_BLA_W_LP = 16,
+  GST_LIBDE265_NAL_BLA_N_LP = 18,
+  GST_LIBDE265_NAL_IDR_W_RADL = 19,
+  GST_LIBDE265_NAL_IDR_N_LP = 20,
+  GST_LIBDE265_NAL_CRA = 21,
+  GST_LIBDE265_NAL_RSV_IRAP_23 = 23,
+  GST_LIBDE265_NAL_VPS = 32,
+  GST_LIBDE265_NAL_SPS = 33,
+  GST_LIBDE265_NAL_PPS = 34,
+  GST_LIBDE265_NAL_AUD = 35,
+  GST_LIBDE265_NAL_EOS = 36,
+  GST_LIBDE265_NAL_PREFIX_SEI = 39,
+  GST_LIBDE265_NAL_RSV_NVCL41 = 41,
+  GST_LIBDE265_NAL_RSV_NVCL44 = 44,
+  GST_LIBDE265_NAL_UNSPEC48 = 48,
+  GST_LIBDE265_NAL_UNSPEC55 = 55
+};
+
+#define GST_LIBDE265_NAL_IS_VCL(type) \
+    ((type) < GST_LIBDE265_NAL_VPS)
+#define GST_LIBDE265_NAL_IS_SWITCHING_POINT(type) \
+    ((type) >= GST_LIBDE265_NAL_TSA_N && (type) <= GST_LIBDE265_NAL_STSA_R)
+#define GST_LIBDE265_NAL_IS_SLNR(type) \
+    ((type) <= 14 && ((type) & 1) == 0)
+#define GST_LIBDE265_NAL_IS_IRAP(type) \
+    ((type) >= GST_LIBDE265_NAL_BLA_W_LP && (type) <= GST_LIBDE265_NAL_RSV_IRAP_23)
+#define GST_LIBDE265_NAL_IS_BLA(type) \
+    ((type) >= GST_LIBDE265_NAL_BLA_W_LP && (type) <= GST_LIBDE265_NAL_BLA_N_LP)
+#define GST_LIBDE265_NAL_IS_RASL(type) \
+    ((type) == GST_LIBDE265_NAL_RASL_N || (type) == GST_LIBDE265_NAL_RASL_R)
+#define GST_LIBDE265_NAL_IS_RADL(type) \
+    ((type) == GST_LIBDE265_NAL_RADL_N || (type) == GST_LIBDE265_NAL_RADL_R)
+#define GST_LIBDE265_NAL_FIRST_SLICE(nal)   (((nal)[2] & 0x80) != 0)
+
+#define GST_LIBDE265_MAX_SUB_LAYERS 7
+
+typedef struct
+{
+  int max_sub_layers;
+  int chroma_format_idc;
+  int width;
+  int height;
+  int bit_depth_luma;
+  int bit_depth_chroma;
+  int max_dec_pic_buffering[GST_LIBDE265_MAX_SUB_LAYERS];
+  int max_num_reorder_pics[GST_LIBDE265_MAX_SUB_LAYERS];
+  int max_latency_increase_plus1[GST_LIBDE265_MAX_SUB_LAYERS];
+  int ctb_size;
+} GstLibde265SPS;
+
+typedef struct
+{
+  gboolean tiles_enabled;
+  gboolean entropy_coding_sync_enabled;
+  int num_tile_columns;
+  int num_tile_rows;
+} GstLibde265PPS;
+
+/* The NAL units passed in start with the two byte NAL unit header. */
+gboolean gst_libde265_nal_parse_sps (const guint8 * nal, gsize size,
+    GstLibde265SPS * sps);
+gboolean gst_libde265_nal_parse_pps (const guint8 * nal, gsize size,
+    GstLibde265PPS * pps);
+
+/*
+ * Check if a NAL unit following a picture starts the next access unit,
+ * at least the first three bytes of the NAL unit must be passed.
+ */
+gboolean gst_libde265_nal_starts_access_unit (const guint8 * nal);
+
+/*
+ * Return a pointer to the next three byte start code (00 00 01) in the
+ * given data or NULL if there is none.
+ */
+const guint8 *gst_libde265_nal_find_start_code (const guint8 * data,
+    const guint8 * end);
+
+G_END_DECLS
+
+#endif  // __GST_LIBDE265_NAL_H__
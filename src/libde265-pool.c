@@ -0,0 +1,195 @@
+/*
+ * GStreamer HEVC/H.265 video codec.
+ *
+ * Copyright (c) 2014 struktur AG, Joachim Bauch <bauch@struktur.de>
+ *
+ * This file is part of gstreamer-libde265.
+ *
+ * libde265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libde265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libde265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include "libde265-pool.h"
+#include "libde265-threads.h"
+
+struct idle_context
+{
+  de265_decoder_context *ctx;
+  int threads;
+};
+
+static GMutex pool_lock;
+// most recently returned context first
+static GList *idle = NULL;
+// thread counts of the contexts that are being started in the background
+static GList *starting = NULL;
+
+// report the worker threads kept by the pool to the thread budget, must
+// be called with the pool lock held
+static void
+_update_pooled (void)
+{
+  int threads = 0;
+  GList *walk;
+  for (walk = idle; walk != NULL; walk = walk->next) {
+    threads += ((struct idle_context *) walk->data)->threads;
+  }
+  for (walk = starting; walk != NULL; walk = walk->next) {
+    threads += GPOINTER_TO_INT (walk->data);
+  }
+  gst_libde265_threads_set_pooled (threads);
+}
+
+// freeing joins the worker threads, must be called without the pool lock
+// so other decoders aren't blocked meanwhile
+static void
+_free_idle (GList * list)
+{
+  while (list != NULL) {
+    struct idle_context *c = (struct idle_context *) list->data;
+    de265_free_decoder (c->ctx);
+    g_slice_free (struct idle_context, c);
+    list = g_list_delete_link (list, list);
+  }
+}
+
+static void
+_clear_at_exit (void)
+{
+  gst_libde265_pool_clear ();
+}
+
+// must be called with the pool lock held
+static GList *
+_find_idle (int threads)
+{
+  GList *walk;
+  for (walk = idle; walk != NULL; walk = walk->next) {
+    struct idle_context *c = (struct idle_context *) walk->data;
+    if (threads == GST_LIBDE265_POOL_ANY_THREADS || c->threads == threads) {
+      return walk;
+    }
+  }
+  return NULL;
+}
+
+de265_decoder_context *
+gst_libde265_pool_acquire (int threads, int *held)
+{
+  de265_decoder_context *ctx = NULL;
+
+  g_mutex_lock (&pool_lock);
+  GList *link = _find_idle (threads);
+  if (link != NULL) {
+    struct idle_context *c = (struct idle_context *) link->data;
+    idle = g_list_delete_link (idle, link);
+    ctx = c->ctx;
+    *held = c->threads;
+    g_slice_free (struct idle_context, c);
+    _update_pooled ();
+  }
+  g_mutex_unlock (&pool_lock);
+  return ctx;
+}
+
+void
+gst_libde265_pool_release (de265_decoder_context * ctx, int threads,
+    int max_idle)
+{
+  static gsize exit_handler = 0;
+  GList *drop = NULL;
+
+  if (g_once_init_enter (&exit_handler)) {
+    // GStreamer never unloads plugins, idle contexts live until the exit
+    atexit (_clear_at_exit);
+    g_once_init_leave (&exit_handler, 1);
+  }
+
+  g_mutex_lock (&pool_lock);
+  struct idle_context *c = g_slice_new (struct idle_context);
+  c->ctx = ctx;
+  c->threads = threads;
+  idle = g_list_prepend (idle, c);
+  while (g_list_length (idle) > MAX (max_idle, 0)) {
+    GList *last = g_list_last (idle);
+    idle = g_list_remove_link (idle, last);
+    drop = g_list_concat (last, drop);
+  }
+  _update_pooled ();
+  g_mutex_unlock (&pool_lock);
+
+  _free_idle (drop);
+}
+
+void
+gst_libde265_pool_clear (void)
+{
+  g_mutex_lock (&pool_lock);
+  GList *drop = idle;
+  idle = NULL;
+  _update_pooled ();
+  g_mutex_unlock (&pool_lock);
+
+  _free_idle (drop);
+}
+
+struct prestart
+{
+  int threads;
+  int max_idle;
+};
+
+static gpointer
+_prestart_thread (gpointer data)
+{
+  struct prestart *p = (struct prestart *) data;
+  de265_decoder_context *ctx = de265_new_decoder ();
+
+  if (ctx != NULL && p->threads > 0) {
+    de265_start_worker_threads (ctx, p->threads);
+  }
+  g_mutex_lock (&pool_lock);
+  starting = g_list_remove (starting, GINT_TO_POINTER (p->threads));
+  _update_pooled ();
+  g_mutex_unlock (&pool_lock);
+  if (ctx != NULL) {
+    gst_libde265_pool_release (ctx, p->threads, p->max_idle);
+  }
+  g_slice_free (struct prestart, p);
+  return NULL;
+}
+
+void
+gst_libde265_pool_prestart (int threads, int max_idle)
+{
+  g_mutex_lock (&pool_lock);
+  if (max_idle <= 0 || _find_idle (threads) != NULL
+      || g_list_find (starting, GINT_TO_POINTER (threads)) != NULL) {
+    g_mutex_unlock (&pool_lock);
+    return;
+  }
+  starting = g_list_prepend (starting, GINT_TO_POINTER (threads));
+  _update_pooled ();
+  g_mutex_unlock (&pool_lock);
+
+  struct prestart *p = g_slice_new (struct prestart);
+  p->threads = threads;
+  p->max_idle = max_idle;
+  g_thread_unref (g_thread_new ("libde265pool", _prestart_thread, p));
+}
@@ -0,0 +1,67 @@
+/*
+ * GStreamer HEVC/H.265 video codec.
+ *
+ * Copyright (c) 2014 struktur AG, Joachim Bauch <bauch@struktur.de>
+ *
+ * This file is part of gstreamer-libde265.
+ *
+ * libde265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libde265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libde265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GST_LIBDE265_POOL_H__
+#define __GST_LIBDE265_POOL_H__
+
+#include <glib.h>
+#include <libde265/de265.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Process-wide pool of idle decoder contexts whose worker threads keep
+ * running. Decoders borrow a context instead of creating one and starting
+ * its threads, and return it after a de265_reset when they stop. The
+ * worker threads of idle contexts count against the thread budget.
+ */
+
+/* Pass to gst_libde265_pool_acquire to take a context with any number of
+ * worker threads. */
+#define GST_LIBDE265_POOL_ANY_THREADS   -1
+
+/*
+ * Take an idle context with "threads" worker threads (0 for none) from the
+ * pool, the most recently returned one is preferred. Returns NULL if there
+ * is none, otherwise stores the number of worker threads in "held".
+ */
+de265_decoder_context *gst_libde265_pool_acquire (int threads, int *held);
+
+/*
+ * Return a context that has been reset to the pool. At most "max_idle"
+ * contexts are kept, the most recently returning decoder sets the limit.
+ * Contexts that don't fit are freed, the others when the process exits.
+ */
+void gst_libde265_pool_release (de265_decoder_context * ctx, int threads,
+    int max_idle);
+
+/*
+ * Start a context with "threads" worker threads in the background unless
+ * the pool already holds one, so the next decoder that starts finds it.
+ */
+void gst_libde265_pool_prestart (int threads, int max_idle);
+
+/* Free all idle contexts. */
+void gst_libde265_pool_clear (void);
+
+G_END_DECLS
+
+#endif  // __GST_LIBDE265_POOL_H__
@@ -0,0 +1,94 @@
+/*
+ * GStreamer HEVC/H.265 video codec.
+ *
+ * Copyright (c) 2014 struktur AG, Joachim Bauch <bauch@struktur.de>
+ *
+ * This file is part of gstreamer-libde265.
+ *
+ * libde265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libde265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libde265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "libde265-stats.h"
+
+static int
+_bucket (gint64 duration)
+{
+  int bits;
+  if (duration < 4) {
+    return MAX (duration, 0);
+  }
+  // highest set bit and the two bits below it
+  bits = g_bit_storage ((guint64) duration);
+  return MIN ((bits - 2) * 4 + ((duration >> (bits - 3)) & 3),
+      GST_LIBDE265_TIMING_BUCKETS - 1);
+}
+
+// largest duration that falls into the bucket
+static gint64
+_bucket_limit (int bucket)
+{
+  int bits;
+  if (bucket < 4) {
+    return bucket;
+  }
+  bits = bucket / 4 + 2;
+  return ((gint64) (4 + bucket % 4 + 1) << (bits - 3)) - 1;
+}
+
+void
+gst_libde265_timing_reset (GstLibde265Timing * timing)
+{
+  memset (timing, 0, sizeof (*timing));
+}
+
+void
+gst_libde265_timing_add (GstLibde265Timing * timing, gint64 duration)
+{
+  if (timing->count == 0 || duration < timing->min) {
+    timing->min = duration;
+  }
+  if (duration > timing->max) {
+    timing->max = duration;
+  }
+  timing->count++;
+  timing->total += duration;
+  timing->buckets[_bucket (duration)]++;
+}
+
+gint64
+gst_libde265_timing_percentile (const GstLibde265Timing * timing, int percent)
+{
+  guint64 wanted;
+  guint64 seen = 0;
+  int i;
+
+  if (timing->count == 0) {
+    return 0;
+  }
+
+  wanted = (timing->count * percent + 99) / 100;
+  for (i = 0; i < GST_LIBDE265_TIMING_BUCKETS; i++) {
+    seen += timing->buckets[i];
+    if (seen >= wanted) {
+      return CLAMP (_bucket_limit (i), timing->min, timing->max);
+    }
+  }
+  return timing->max;
+}
@@ -0,0 +1,53 @@
+/*
+ * GStreamer HEVC/H.265 video codec.
+ *
+ * Copyright (c) 2014 struktur AG, Joachim Bauch <bauch@struktur.de>
+ *
+ * This file is part of gstreamer-libde265.
+ *
+ * libde265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libde265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libde265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GST_LIBDE265_STATS_H__
+#define __GST_LIBDE265_STATS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+// four buckets per power of two, up to about 16 seconds
+#define GST_LIBDE265_TIMING_BUCKETS 96
+
+/*
+ * Distribution of durations in microseconds. Percentiles are taken from
+ * a logarithmic histogram, so adding a value is constant time and they
+ * are accurate to about 20%.
+ */
+typedef struct
+{
+  guint64 count;
+  gint64 total;
+  gint64 min;
+  gint64 max;
+  guint buckets[GST_LIBDE265_TIMING_BUCKETS];
+} GstLibde265Timing;
+
+void gst_libde265_timing_reset (GstLibde265Timing * timing);
+void gst_libde265_timing_add (GstLibde265Timing * timing, gint64 duration);
+gint64 gst_libde265_timing_percentile (const GstLibde265Timing * timing,
+    int percent);
+
+G_END_DECLS
+
+#endif  // __GST_LIBDE265_STATS_H__
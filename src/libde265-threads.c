@@ -0,0 +1,253 @@
+/*
+ * GStreamer HEVC/H.265 video codec.
+ *
+ * Copyright (c) 2014 struktur AG, Joachim Bauch <bauch@struktur.de>
+ *
+ * This file is part of gstreamer-libde265.
+ *
+ * libde265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libde265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libde265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <unistd.h>
+
+#include "libde265-threads.h"
+
+// use two decoder threads if no information about
+// available CPU cores can be retrieved
+#define DEFAULT_THREAD_COUNT        2
+
+#define SAMPLES_PER_THREAD          (640 * 360)
+
+struct member
+{
+  gconstpointer owner;
+  int wanted;
+  int target;
+  int held;
+};
+
+static GMutex budget_lock;
+static GList *members = NULL;
+static int budget = 0;
+// worker threads of idle contexts in the pool
+static int pooled = 0;
+
+int
+gst_libde265_threads_auto_count (void)
+{
+  int threads;
+#if defined(_SC_NPROC_ONLN)
+  threads = sysconf (_SC_NPROC_ONLN);
+#elif defined(_SC_NPROCESSORS_ONLN)
+  threads = sysconf (_SC_NPROCESSORS_ONLN);
+#else
+#warning "Don't know how to get number of CPU cores, will use the default thread count"
+  threads = DEFAULT_THREAD_COUNT;
+#endif
+  if (threads <= 0) {
+    threads = DEFAULT_THREAD_COUNT;
+  }
+  // XXX: We start more threads than cores for now, as some threads
+  // might get blocked while waiting for dependent data. Having more
+  // threads increases decoding speed by about 10%
+  return threads * 2;
+}
+
+int
+gst_libde265_threads_for_stream (int width, int height, int ctb_size,
+    int tiles, gboolean wpp)
+{
+  int ctb_columns = (width + ctb_size - 1) / ctb_size;
+  int ctb_rows = (height + ctb_size - 1) / ctb_size;
+  int useful;
+
+  if (wpp) {
+    // each wavefront row trails the one above by two CTBs
+    useful = MIN (ctb_rows, (ctb_columns + 1) / 2) * MAX (tiles, 1);
+  } else if (tiles > 1) {
+    useful = tiles;
+  } else {
+    // slices are decoded serially, only deblocking and SAO run in
+    // parallel on bands of CTB rows
+    useful = ctb_rows / 8;
+  }
+  // don't spend more threads on a picture than its size justifies,
+  // about one per 640x360 luma samples
+  useful = MIN (useful, ((gint64) width * height + SAMPLES_PER_THREAD - 1)
+      / SAMPLES_PER_THREAD);
+  return CLAMP (useful, 1, gst_libde265_threads_auto_count ());
+}
+
+static struct member *
+_find_member (gconstpointer owner)
+{
+  GList *walk;
+  for (walk = members; walk != NULL; walk = walk->next) {
+    struct member *m = (struct member *) walk->data;
+    if (m->owner == owner) {
+      return m;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Split the budget between the members, must be called with the budget
+ * lock held. Members that want less than an equal share leave the rest to
+ * the others, what can't be split evenly goes to the oldest members.
+ */
+static void
+_update_targets (void)
+{
+  int remaining = budget;
+  int open = 0;
+  int share = 0;
+  gboolean changed = TRUE;
+  GList *walk;
+
+  for (walk = members; walk != NULL; walk = walk->next) {
+    struct member *m = (struct member *) walk->data;
+    m->target = -1;
+    open++;
+  }
+  while (changed && open > 0) {
+    changed = FALSE;
+    share = remaining / open;
+    for (walk = members; walk != NULL; walk = walk->next) {
+      struct member *m = (struct member *) walk->data;
+      if (m->target < 0 && m->wanted <= share) {
+        m->target = MAX (m->wanted, 0);
+        remaining -= m->target;
+        open--;
+        changed = TRUE;
+      }
+    }
+  }
+  if (open == 0) {
+    return;
+  }
+  share = remaining / open;
+  remaining -= share * open;
+  // new members are prepended
+  for (walk = g_list_last (members); walk != NULL; walk = walk->prev) {
+    struct member *m = (struct member *) walk->data;
+    if (m->target < 0) {
+      m->target = share + (remaining > 0 ? 1 : 0);
+      remaining--;
+    }
+  }
+}
+
+/*
+ * Threads a member can hold if "reserved" threads of the budget are used
+ * by idle contexts, must be called with the budget lock held. Threads that
+ * other members still hold beyond their share are only available once
+ * they have given them back.
+ */
+static int
+_fair_share (struct member *m, int reserved)
+{
+  int available = budget - reserved;
+  GList *walk;
+
+  for (walk = members; walk != NULL; walk = walk->next) {
+    struct member *other = (struct member *) walk->data;
+    if (other != m) {
+      available -= other->held;
+    }
+  }
+  return MAX (0, MIN (m->target, available));
+}
+
+void
+gst_libde265_threads_join (gconstpointer owner, int new_budget, int wanted)
+{
+  g_mutex_lock (&budget_lock);
+  struct member *m = _find_member (owner);
+  if (m == NULL) {
+    m = g_slice_new0 (struct member);
+    m->owner = owner;
+    members = g_list_prepend (members, m);
+  }
+  m->wanted = wanted;
+  // the budget is process-wide, the most recent configuration wins
+  budget = new_budget;
+  _update_targets ();
+  g_mutex_unlock (&budget_lock);
+}
+
+void
+gst_libde265_threads_leave (gconstpointer owner)
+{
+  g_mutex_lock (&budget_lock);
+  struct member *m = _find_member (owner);
+  if (m != NULL) {
+    members = g_list_remove (members, m);
+    g_slice_free (struct member, m);
+    _update_targets ();
+  }
+  g_mutex_unlock (&budget_lock);
+}
+
+int
+gst_libde265_threads_assign (gconstpointer owner)
+{
+  int result = 0;
+  g_mutex_lock (&budget_lock);
+  struct member *m = _find_member (owner);
+  if (m != NULL) {
+    m->held = result = _fair_share (m, pooled);
+  }
+  g_mutex_unlock (&budget_lock);
+  return result;
+}
+
+gboolean
+gst_libde265_threads_needs_rebalance (gconstpointer owner)
+{
+  gboolean result = FALSE;
+  g_mutex_lock (&budget_lock);
+  struct member *m = _find_member (owner);
+  if (m != NULL) {
+    // idle contexts give way to the members
+    result = (_fair_share (m, 0) != m->held);
+  }
+  g_mutex_unlock (&budget_lock);
+  return result;
+}
+
+gboolean
+gst_libde265_threads_limited_by_pool (gconstpointer owner)
+{
+  gboolean result = FALSE;
+  g_mutex_lock (&budget_lock);
+  struct member *m = _find_member (owner);
+  if (m != NULL && pooled > 0) {
+    result = (_fair_share (m, pooled) < _fair_share (m, 0));
+  }
+  g_mutex_unlock (&budget_lock);
+  return result;
+}
+
+void
+gst_libde265_threads_set_pooled (int threads)
+{
+  g_mutex_lock (&budget_lock);
+  pooled = threads;
+  g_mutex_unlock (&budget_lock);
+}
@@ -0,0 +1,70 @@
+/*
+ * GStreamer HEVC/H.265 video codec.
+ *
+ * Copyright (c) 2014 struktur AG, Joachim Bauch <bauch@struktur.de>
+ *
+ * This file is part of gstreamer-libde265.
+ *
+ * libde265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libde265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libde265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GST_LIBDE265_THREADS_H__
+#define __GST_LIBDE265_THREADS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Number of worker threads to use if none has been configured. */
+int gst_libde265_threads_auto_count (void);
+
+/*
+ * Number of worker threads that can be kept busy decoding a stream with
+ * the given picture size and parallel decoding tools, limited to
+ * gst_libde265_threads_auto_count.
+ */
+int gst_libde265_threads_for_stream (int width, int height, int ctb_size,
+    int tiles, gboolean wpp);
+
+/*
+ * Process-wide worker thread budget shared by all decoders that join it.
+ * Each member asks for a number of threads and is assigned its fair share
+ * of the budget, the shares change as members join and leave. libde265
+ * can't resize the worker pool of a running decoder, so members pick up a
+ * changed share by calling gst_libde265_threads_assign when they recreate
+ * their context. A member only gets threads that the others have given
+ * back this way.
+ */
+void gst_libde265_threads_join (gconstpointer owner, int budget, int wanted);
+void gst_libde265_threads_leave (gconstpointer owner);
+
+/* Assign the current fair share to the member and return it. */
+int gst_libde265_threads_assign (gconstpointer owner);
+
+/* Check if the fair share of the member differs from what it holds. */
+gboolean gst_libde265_threads_needs_rebalance (gconstpointer owner);
+
+/*
+ * The worker threads of idle contexts in the pool count against the
+ * budget. Check if they keep the member from getting its fair share, the
+ * idle contexts should be freed then.
+ */
+gboolean gst_libde265_threads_limited_by_pool (gconstpointer owner);
+
+/* Set the number of worker threads of idle contexts in the pool. */
+void gst_libde265_threads_set_pooled (int threads);
+
+G_END_DECLS
+
+#endif  // __GST_LIBDE265_THREADS_H__